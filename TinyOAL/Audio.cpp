@@ -18,6 +18,9 @@ Audio::Audio(const Audio& copy)
   prev    = nullptr;
   next    = nullptr;
   _source = nullptr;
+  _cache  = nullptr; // Skip() below puts the stream where the copy was, so we don't need a cache
+  _parked = nullptr;
+  _parkedat = (uint64_t)-1;
 
   if(!_resource)
   {
@@ -27,8 +30,8 @@ Audio::Audio(const Audio& copy)
 
   _resource->Grab();
   bun::LLAdd<Audio>(this, _resource->_inactivelist);
-  _source = TinyOAL::Instance()->GetEngine()->GenSource(&ReadBuffer, _resource->GetBufSize(), _resource->GetFormat(),
-                                                        _resource->GetFreq());
+  _source = TinyOAL::Instance()->GetEngine()->GenSource(&ReadBuffer, &PeekBuffer, _resource->GetBufSize(),
+                                                        _resource->GetFormat(), _resource->GetFreq());
 
   _stream = (!_source) ? nullptr : _resource->OpenStream(); // If we don't have oalFuncs, force stream to 0
   if(_stream != nullptr)
@@ -53,7 +56,11 @@ Audio::Audio(AudioResource* ref, TINYOAL_FLAG addflags, void* _userdata) :
   _stream(nullptr),
   _source(nullptr),
   _resource(ref),
-  userdata(_userdata)
+  userdata(_userdata),
+  _cache(nullptr),
+  _cachepos(0),
+  _parked(nullptr),
+  _parkedat((uint64_t)-1)
 {
   _pos[0] = 0.0f;
   _pos[1] = 0.0f;
@@ -71,12 +78,13 @@ Audio::Audio(AudioResource* ref, TINYOAL_FLAG addflags, void* _userdata) :
   _looptime = ref->GetLoopPoint();
   _flags += ref->GetFlags();
   bun::LLAdd<Audio>(this, ref->_inactivelist);
-  _source = TinyOAL::Instance()->GetEngine()->GenSource(&ReadBuffer, _resource->GetBufSize(), _resource->GetFormat(),
-                                                        _resource->GetFreq());
+  _source = TinyOAL::Instance()->GetEngine()->GenSource(&ReadBuffer, &PeekBuffer, _resource->GetBufSize(),
+                                                        _resource->GetFormat(), _resource->GetFreq());
 
   _stream = (!_source) ? nullptr : ref->OpenStream(); // If we don't have oalFuncs, force stream to 0
   if(_stream != nullptr)
   {
+    _cache = !ref->_prefix.len ? nullptr : &ref->_prefix;
     // Fill all the Buffers with decoded audio data
     _source->FillBuffers(this);
   }
@@ -95,10 +103,12 @@ Audio::~Audio()
   _flags -= TINYOAL_MANAGED; // Remove the flag first, which prevents us from going into an infinite loop
   Stop();                    // Stop destroys the source for us and ensures we are in the inactive list
 
-  if(_stream)
+  if(_resource)
   {
-    if(_resource)
+    if(_stream)
       _resource->CloseStream(_stream);
+    if(_parked)
+      _resource->CloseStream(_parked);
   }
 
   if(_resource)
@@ -153,6 +163,8 @@ void Audio::Stop()
   if(_stream != 0)
   {
     _resource->Reset(_stream);
+    _cache    = !_resource->_prefix.len ? nullptr : &_resource->_prefix; // Start over from the cached prefix
+    _cachepos = 0;
     _source->FillBuffers(this); // Refill all buffers
   }
 
@@ -184,6 +196,7 @@ bool Audio::Skip(uint64_t sample)
     return false;
   if(!_resource->Skip(_stream, sample))
     return false;
+  _cache = nullptr; // The stream is wherever we skipped to now, so whatever we were copying is useless
 
   _source->Skip(this);
   if(_flags & TINYOAL_ISPLAYING)
@@ -195,6 +208,8 @@ uint64_t Audio::IsWhere() const
 {
   if(!_resource || !_stream)
     return 0;
+  if(_cache != nullptr)
+    return _cache->start + _cachepos / (_resource->_channels * (_resource->_samplebits >> 3));
   return _resource->Tell(_stream);
 }
 
@@ -212,7 +227,10 @@ bool Audio::Update()
     return false;
 
   if(_source->Update(this, _flags & TINYOAL_ISPLAYING))
+  {
+    _park(); // Once the buffers are full, so seeking here can't starve them
     return true;
+  }
 
   Stop();
   return false;
@@ -221,7 +239,10 @@ void Audio::Invalidate()
 {
   if(_stream && _resource)
     _resource->CloseStream(_stream);
+  if(_parked && _resource)
+    _resource->CloseStream(_parked);
   _stream   = 0;
+  _parked   = 0;
   _resource = 0;
 }
 
@@ -263,16 +284,26 @@ unsigned long Audio::_readBuffer(unsigned long bufsize, char* buffer)
 {
   bool eof;
   unsigned long hold;
-  unsigned long ulBytesWritten = _resource->Read(_stream, buffer, bufsize, eof);
+  unsigned long ulBytesWritten = _read(buffer, bufsize, eof);
   if(eof && _looptime != (uint64_t)-1)
   {
+    const AudioCache* loop = &_resource->_loopcache;
     while(eof && ulBytesWritten <
                    bufsize) // If we didn't completely fill up our buffer, we hit the end, so if we're looping, reset.
     { // We reset the stream here for every loop, because we will only loop if we hit the end of the stream.
-      _resource->Skip(_stream,
-                      _looptime); // This is because if we didn't hit the end, Read will return _bufsize-ulBytesWritten,
-      hold = _resource->Read(_stream, buffer + ulBytesWritten, bufsize - ulBytesWritten,
-                             eof); // which will make ulBytesWritten==_bufsize.
+      if(loop->len > 0 && loop->start == _looptime)
+      { // If the resource has the loop point cached, we copy from that and swap in the parked stream once it runs out
+        _cache    = loop;
+        _cachepos = 0;
+      }
+      else
+      {
+        _cache = nullptr;
+        if(!_unpark(_looptime))
+          _resource->Skip(_stream, _looptime); // Only if the parked stream isn't there yet, or couldn't get there
+      }
+      // If we didn't hit the end, Read will return _bufsize-ulBytesWritten, which will make ulBytesWritten==_bufsize.
+      hold = _read(buffer + ulBytesWritten, bufsize - ulBytesWritten, eof);
       if(!hold)
         break; // If Read returns 0 AFTER we attempted to go back to the loop location, something is wrong, so bail out.
       ulBytesWritten += hold;
@@ -281,8 +312,83 @@ unsigned long Audio::_readBuffer(unsigned long bufsize, char* buffer)
   return ulBytesWritten;
 }
 
+unsigned long Audio::_read(char* buffer, unsigned long len, bool& eof)
+{
+  if(!_cache)
+    return _resource->Read(_stream, buffer, len, eof);
+
+  // Copy what we can out of the cache. Once it runs out, the stream has to be moved to where the cache ends, since it
+  // could be anywhere.
+  const AudioCache* cache = _cache;
+  unsigned long n         = (unsigned long)std::min<size_t>(len, cache->len - _cachepos);
+  memcpy(buffer, cache->data + _cachepos, n);
+  _cachepos += n;
+  eof = false;
+  if(_cachepos < cache->len)
+    return n;
+  _cache = nullptr;
+  if(cache->eof)
+  {
+    eof = true;
+    return n;
+  }
+  uint64_t end = cache->start + cache->len / (_resource->_channels * (_resource->_samplebits >> 3));
+  if(!_unpark(end) && !_resource->Skip(_stream, end))
+  {
+    TINYOAL_LOG(2, "Failed to skip past the cached samples");
+    eof = true;
+    return n;
+  }
+  if(n < len)
+    n += _resource->Read(_stream, buffer + n, len - n, eof);
+  return n;
+}
+
+// Keeps a second stream waiting where the stream will have to be the next time it loops, which is where the loop cache
+// ends if the resource has one, or the loop point if it doesn't. Looping swaps it in instead of seeking, and the stream
+// it replaces gets sent back here on the next update, after the buffers have been refilled. WAV streams seek without
+// decoding anything, so they don't bother.
+void Audio::_park()
+{
+  if(_looptime == (uint64_t)-1 || !_stream || _resource->GetFileType() == AudioResource::TINYOAL_FILETYPE_WAV)
+    return;
+  const AudioCache* loop = &_resource->_loopcache;
+  uint64_t target        = (loop->len > 0 && loop->start == _looptime) ?
+                             loop->start + loop->len / (_resource->_channels * (_resource->_samplebits >> 3)) :
+                             _looptime;
+  if(_parkedat == target || (loop->eof && loop->start == _looptime))
+    return; // Already there, or it failed to get there last time, or the whole loop is cached and we never need it
+  _parkedat = target;
+  if(!_parked && !(_parked = _resource->OpenStream()))
+    return;
+  if(!_resource->Skip(_parked, target))
+  {
+    TINYOAL_LOG(2, "Failed to park a stream at the loop point");
+    _resource->CloseStream(_parked);
+    _parked = nullptr;
+  }
+}
+
+// Swaps in the parked stream if it's waiting at sample
+bool Audio::_unpark(uint64_t sample)
+{
+  if(!_parked || _parkedat != sample)
+    return false;
+  std::swap(_stream, _parked);
+  _parkedat = (uint64_t)-1;
+  return true;
+}
+
 unsigned long Audio::ReadBuffer(unsigned long bufsize, char* buffer, void* context)
 {
   auto audio = (Audio*)context;
   return audio->_readBuffer(bufsize, buffer);
 }
+
+const char* Audio::PeekBuffer(unsigned long bufsize, void* context)
+{ // Anything that needs a cache or a loop in the middle of the buffer goes through ReadBuffer instead
+  auto audio = (Audio*)context;
+  if(audio->_cache || !audio->_stream)
+    return nullptr;
+  return audio->_resource->Peek(audio->_stream, bufsize);
+}
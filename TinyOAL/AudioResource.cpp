@@ -4,10 +4,22 @@
 
 #include "tinyoal/AudioResource.h"
 #include "tinyoal/TinyOAL.h"
+#include "WaveFunctions.h"
+#include "Engine.h"
+#include "ReadAhead.h"
+#ifdef BUN_PLATFORM_WIN32
+  #include <io.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+#include <errno.h>
 
 using namespace tinyoal;
 
-AudioResource::AudioResource(void* data, uint32_t len, TINYOAL_FLAG flags, unsigned char filetype, uint64_t loop) :
+AudioResource::AudioResource(void* data, uint64_t len, TINYOAL_FLAG flags, unsigned char filetype, uint64_t loop) :
   _data(data),
   _datalength(len),
   _flags(flags),
@@ -22,7 +34,9 @@ AudioResource::AudioResource(void* data, uint32_t len, TINYOAL_FLAG flags, unsig
   _inactivelist(0),
   _maxactive(0),
   _total(0),
-  _filetype(TINYOAL_FILETYPE(filetype))
+  _filetype(TINYOAL_FILETYPE(filetype)),
+  _prefix(),
+  _loopcache()
 {
   bun::LLAdd<AudioResource>(this, TinyOAL::Instance()->_reslist);
 }
@@ -34,8 +48,12 @@ AudioResource::~AudioResource()
   TinyOAL::Instance()->_audiohash.Remove(_hash);
   if(_flags & TINYOAL_ISFILE)
     fclose((FILE*)_data);
+  else if(_flags & TINYOAL_MMAP)
+    _unmapfile(_data, _datalength);
   else if(_flags & TINYOAL_COPYINTOMEMORY && _data != 0)
     free(_data);
+  free(_prefix.data);
+  free(_loopcache.data);
   bun::LLRemove<AudioResource>(this, TinyOAL::Instance()->_reslist);
 }
 
@@ -54,6 +72,39 @@ void AudioResource::_destruct()
   }
 }
 
+void AudioResource::_cache(AudioCache& cache, uint64_t start, uint32_t milliseconds)
+{
+  uint32_t frame = _channels * (_samplebits >> 3);
+  if(!milliseconds || !frame || !_format)
+    return;
+  size_t len   = (size_t)(((uint64_t)_freq * milliseconds) / 1000) * frame;
+  void* stream = OpenStream();
+  if(!stream)
+    return;
+
+  if((!start || Skip(stream, start)) && (cache.data = (char*)malloc(len)) != nullptr)
+  {
+    bool eof = false;
+    size_t n = 0;
+    while(n < len && !eof)
+    {
+      unsigned long r = Read(stream, cache.data + n, (unsigned int)(len - n), eof);
+      if(!r)
+        break;
+      n += r;
+    }
+    cache.len   = n - (n % frame);
+    cache.start = start;
+    cache.eof   = eof;
+    if(!cache.len)
+    {
+      free(cache.data);
+      cache.data = 0;
+    }
+  }
+  CloseStream(stream);
+}
+
 void AudioResource::DestroyThis() { delete this; }
 Audio* AudioResource::Play(TINYOAL_FLAG flags)
 {
@@ -74,6 +125,27 @@ Audio* AudioResource::Play(TINYOAL_FLAG flags)
 
 AudioResource* AudioResource::Create(const char* file, TINYOAL_FLAG flags, unsigned char filetype, uint64_t loop)
 {
+  if(flags & TINYOAL_MMAP)
+  {
+    uint64_t len = 0;
+    if(void* data = _mapfile(file, len, flags))
+    {
+      if(!filetype)
+        filetype = TinyOAL::Instance()->_getFiletype((const char*)data, (size_t)std::min<uint64_t>(len, 36));
+
+      AudioResource* r;
+      if((flags & TINYOAL_FORCETOWAVE) == TINYOAL_FORCETOWAVE) // The mapping is only needed while we decode it
+        r = _force(data, len, flags & (~TINYOAL_MMAP), filetype, file, loop);
+      else
+        r = _create(data, len, flags & (~TINYOAL_COPYINTOMEMORY), filetype, file, loop);
+      if(!r || !(r->_flags & TINYOAL_MMAP) || r->_data != data) // Failed, forced, or already loaded
+        _unmapfile(data, len);
+      return r;
+    }
+    TINYOAL_LOG(2, "Failed to map %s, reading it instead", file);
+    flags &= ~TINYOAL_MMAP;
+  }
+
   FILE* f;
 #ifdef BUN_PLATFORM_WIN32
   _wfopen_s(&f, bun::StrW(file).c_str(), L"rb");
@@ -82,21 +154,21 @@ AudioResource* AudioResource::Create(const char* file, TINYOAL_FLAG flags, unsig
 #endif
   if(!f)
     return 0;
-  fseek(f, 0, SEEK_END);
-  long len = ftell(f);
-  fseek(f, 0, SEEK_SET);
+  file_seek_func(f, 0, SEEK_END);
+  int64_t len = file_tell_func(f);
+  file_seek_func(f, 0, SEEK_SET);
   AudioResource* r = _fcreate(f, len, flags, filetype, file, loop);
   if(flags & TINYOAL_COPYINTOMEMORY)
     fclose(f);
   return r;
 }
-AudioResource* AudioResource::Create(FILE* file, uint32_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
+AudioResource* AudioResource::Create(FILE* file, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                      uint64_t loop)
 {
   return AudioResource::_fcreate(file, datalength, flags | TINYOAL_COPYINTOMEMORY, filetype, bun::StrF("%p", file), loop);
 }
 
-AudioResource* AudioResource::Create(const void* data, uint32_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
+AudioResource* AudioResource::Create(const void* data, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                      uint64_t loop)
 {
   if(!data || datalength < 8) // bad file pointer
@@ -109,7 +181,7 @@ AudioResource* AudioResource::Create(const void* data, uint32_t datalength, TINY
   }
 
   if(!filetype)
-    filetype = TinyOAL::Instance()->_getFiletype((const char*)data);
+    filetype = TinyOAL::Instance()->_getFiletype((const char*)data, datalength);
 
   if((flags & TINYOAL_FORCETOWAVE) == TINYOAL_FORCETOWAVE)
     return _force(const_cast<void*>(data), datalength, flags, filetype, bun::StrF("%p", data), loop);
@@ -124,7 +196,7 @@ AudioResource* AudioResource::Create(const void* data, uint32_t datalength, TINY
   return _create(const_cast<void*>(data), datalength, flags, filetype, bun::StrF("%p", data), loop);
 }
 
-AudioResource* AudioResource::_force(void* data, uint32_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
+AudioResource* AudioResource::_force(void* data, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                      const char* path, uint64_t loop)
 {
   TinyOAL::Codec* c = TinyOAL::Instance()->GetCodec(filetype);
@@ -133,13 +205,43 @@ AudioResource* AudioResource::_force(void* data, uint32_t datalength, TINYOAL_FL
     TINYOAL_LOG(2, "%p is using an unknown or unrecognized format, or may be corrupt.", data);
     return 0;
   }
-  std::pair<void*, uint32_t> d = c->towave(data, datalength, flags);
+  std::pair<void*, uint64_t> d = c->towave(data, datalength, flags);
 
   if(!d.first)
     return 0;
+  if((flags & TINYOAL_SPATIAL) == TINYOAL_SPATIAL)
+  {
+    std::pair<void*, uint64_t> m = TinyOAL::Instance()->GetWave()->ToMono(d.first, d.second);
+    if(m.first) // Done first, so resampling and transcoding only have one channel left to work on
+    {
+      free(d.first);
+      d = m;
+    }
+  }
+  if((flags & TINYOAL_RESAMPLE) == TINYOAL_RESAMPLE)
+  {
+    uint32_t freq = TinyOAL::Instance()->GetEngine()->GetFrequency();
+    if(!freq)
+      TINYOAL_LOG(2, "Couldn't get the output frequency of the device, %s won't be resampled", path);
+    std::pair<void*, uint64_t> r = TinyOAL::Instance()->GetWave()->Resample(d.first, d.second, freq, loop);
+    if(r.first) // Has to happen before the ADPCM transcode, which can't be resampled
+    {
+      free(d.first);
+      d = r;
+    }
+  }
+  if((flags & TINYOAL_FORCETOADPCM) == TINYOAL_FORCETOADPCM)
+  {
+    std::pair<void*, uint64_t> a = TinyOAL::Instance()->GetWave()->ToImaAdpcm(d.first, d.second);
+    if(a.first) // If it can't be transcoded, we just keep the uncompressed wave
+    {
+      free(d.first);
+      d = a;
+    }
+  }
   return _create(d.first, d.second, flags & (~TINYOAL_ISFILE), TINYOAL_FILETYPE_WAV, path, loop);
 }
-AudioResource* AudioResource::_fcreate(FILE* file, uint32_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
+AudioResource* AudioResource::_fcreate(FILE* file, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                        const char* path, uint64_t loop)
 {
   if(!file || datalength < 8) // bad file pointer
@@ -153,10 +255,10 @@ AudioResource* AudioResource::_fcreate(FILE* file, uint32_t datalength, TINYOAL_
 
   if(!filetype)
   {
-    char fheader[8] = { 0 };
-    fread(fheader, 1, 8, file);
-    fseek(file, -8, SEEK_CUR); // reset file pointer (do NOT use set here or we'll lose the relative positioning
-    filetype = TinyOAL::Instance()->_getFiletype(fheader);
+    char fheader[36] = { 0 };
+    size_t n         = fread(fheader, 1, (size_t)std::min<uint64_t>(sizeof(fheader), datalength), file);
+    fseek(file, -(long)n, SEEK_CUR); // reset file pointer (do NOT use set here or we'll lose the relative positioning
+    filetype = TinyOAL::Instance()->_getFiletype(fheader, n);
   }
 
   if((flags & TINYOAL_FORCETOWAVE) == TINYOAL_FORCETOWAVE)
@@ -172,7 +274,7 @@ AudioResource* AudioResource::_fcreate(FILE* file, uint32_t datalength, TINYOAL_
   return _create(file, datalength, flags | TINYOAL_ISFILE, filetype, path, loop);
 }
 
-AudioResource* AudioResource::_create(void* data, uint32_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
+AudioResource* AudioResource::_create(void* data, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                       const char* path, uint64_t loop)
 {
   const char* hash = (flags & TINYOAL_COPYINTOMEMORY) ? "" : path;
@@ -193,6 +295,12 @@ AudioResource* AudioResource::_create(void* data, uint32_t datalength, TINYOAL_F
   size_t len = c->construct(0, 0, 0, 0, 0);
   r          = (AudioResource*)malloc(len);
   c->construct(r, data, datalength, flags, loop);
+  if(filetype != TINYOAL_FILETYPE_WAV) // Wave data is cheap enough to read that caching it wouldn't help
+  {
+    r->_cache(r->_prefix, 0, TinyOAL::Instance()->GetPrefixCache());
+    if(r->_loop != (uint64_t)-1)
+      r->_cache(r->_loopcache, r->_loop, TinyOAL::Instance()->GetLoopCache());
+  }
 
   if(hash[0])
     TinyOAL::Instance()->_audiohash.Insert((r->_hash = hash).c_str(), r);
@@ -201,11 +309,89 @@ AudioResource* AudioResource::_create(void* data, uint32_t datalength, TINYOAL_F
   return r;
 }
 
+#ifdef BUN_PLATFORM_WIN32
+// PrefetchVirtualMemory only exists on Windows 8 and up, and we still target Windows 7, so it has to be looked up
+struct TOAL_MEMORY_RANGE_ENTRY
+{
+  PVOID VirtualAddress;
+  SIZE_T NumberOfBytes;
+};
+typedef BOOL(WINAPI* LPPREFETCHVIRTUALMEMORY)(HANDLE, ULONG_PTR, TOAL_MEMORY_RANGE_ENTRY*, ULONG);
+#endif
+
+// Only this much of a mapped file is read in up front, which covers the headers and the first few seconds. The rest is
+// left to the kernel's readahead, so mapping a huge file doesn't read all of it or push other processes out of the cache.
+static const uint64_t MAPFILE_PREFETCH = 4 << 20;
+
+// Mapped files keep the default access pattern, because several streams can read the same mapping at different spots and
+// other processes share its pages. Files that are only mapped to be decoded into memory are read once from front to
+// back, and TINYOAL_MMAPRANDOM is for resources that seek around too much for readahead to help.
+void* AudioResource::_mapfile(const char* file, uint64_t& datalength, TINYOAL_FLAG flags)
+{
+  void* data = 0;
+#ifdef BUN_PLATFORM_WIN32
+  HANDLE f = CreateFileW(bun::StrW(file).c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+  if(f == INVALID_HANDLE_VALUE)
+    return 0;
+  LARGE_INTEGER size;
+  if(GetFileSizeEx(f, &size) && size.QuadPart >= 8)
+  {
+    HANDLE m = CreateFileMappingW(f, 0, PAGE_READONLY, 0, 0, 0);
+    if(m)
+    {
+      data = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(m); // The view keeps the mapping alive
+    }
+    // Windows has no access pattern hints for a view, so all we can do is prefetch the start of it
+    static LPPREFETCHVIRTUALMEMORY prefetch =
+      (LPPREFETCHVIRTUALMEMORY)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+    if(data && prefetch)
+    {
+      TOAL_MEMORY_RANGE_ENTRY range = { data, (SIZE_T)std::min<uint64_t>(size.QuadPart, MAPFILE_PREFETCH) };
+      prefetch(GetCurrentProcess(), 1, &range, 0);
+    }
+    datalength = size.QuadPart;
+  }
+  CloseHandle(f);
+#else
+  int fd = open(file, O_RDONLY);
+  if(fd < 0)
+    return 0;
+  struct stat st;
+  if(!fstat(fd, &st) && st.st_size >= 8)
+  {
+    data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED)
+      data = 0;
+    else
+    {
+      if((flags & TINYOAL_FORCETOWAVE) == TINYOAL_FORCETOWAVE)
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+      else if((flags & TINYOAL_MMAPRANDOM) == TINYOAL_MMAPRANDOM)
+        madvise(data, (size_t)st.st_size, MADV_RANDOM);
+      madvise(data, (size_t)std::min<uint64_t>(st.st_size, MAPFILE_PREFETCH), MADV_WILLNEED);
+    }
+    datalength = st.st_size;
+  }
+  close(fd); // The mapping keeps the file open
+#endif
+  return data;
+}
+
+void AudioResource::_unmapfile(void* data, uint64_t datalength)
+{
+#ifdef BUN_PLATFORM_WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(data, (size_t)datalength);
+#endif
+}
+
 // 8 functions - Four for parsing pure void*, and four for reading files
 size_t tinyoal::dat_read_func(void* ptr, size_t size, size_t nmemb, void* datasource)
 {
   DatStream* data = (DatStream*)datasource;
-  size_t retval   = (data->datalength - dat_tell_func(datasource)) / size;
+  size_t retval   = (size_t)((data->datalength - dat_tell_func(datasource)) / size);
   retval          = nmemb > retval ? retval : nmemb; // This ensures we never read past the end but still conform to size restrictions
   memcpy(ptr, data->streampos, retval * size);
   data->streampos += retval * size; // increment stream pointer
@@ -220,18 +406,18 @@ int tinyoal::dat_seek_func(void* datasource, int64_t offset, int whence) // Who
   switch(whence)
   {
   case SEEK_END:
-    if((pos = data->datalength + offset) < 0 || pos > data->datalength)
+    if((pos = (int64_t)data->datalength + offset) < 0 || (uint64_t)pos > data->datalength)
       return -1; // fail
     data->streampos = data->data + pos;
     return 0;
   case SEEK_SET:
-    if(offset < 0 || (uint32_t)offset > data->datalength)
+    if(offset < 0 || (uint64_t)offset > data->datalength)
       return -1;
     data->streampos = data->data + offset;
     return 0;
   default:
   case SEEK_CUR:
-    if((pos = dat_tell_func(datasource) + offset) < 0 || pos > data->datalength)
+    if((pos = dat_tell_func(datasource) + offset) < 0 || (uint64_t)pos > data->datalength)
       return -1;
     data->streampos += offset;
     return 0;
@@ -243,7 +429,7 @@ int tinyoal::dat_close_func(void* datasource)
   return 0; // We manage file opening and closing.
 }
 
-long tinyoal::dat_tell_func(void* datasource)
+int64_t tinyoal::dat_tell_func(void* datasource)
 {
   DatStream* data = (DatStream*)datasource;
   return data->streampos - data->data;
@@ -256,7 +442,11 @@ size_t tinyoal::file_read_func(void* ptr, size_t size, size_t nmemb, void* datas
 
 int tinyoal::file_seek_func(void* datasource, int64_t offset, int whence)
 {
-  return fseek((FILE*)datasource, (long)offset, whence);
+#ifdef BUN_PLATFORM_WIN32
+  return _fseeki64((FILE*)datasource, offset, whence);
+#else
+  return fseeko((FILE*)datasource, (off_t)offset, whence);
+#endif
 }
 
 int tinyoal::file_close_func(void* datasource)
@@ -264,4 +454,201 @@ int tinyoal::file_close_func(void* datasource)
   return 0; // We manage file opening and closing.
 }
 
-long tinyoal::file_tell_func(void* datasource) { return ftell((FILE*)datasource); }
\ No newline at end of file
+int64_t tinyoal::file_tell_func(void* datasource)
+{
+#ifdef BUN_PLATFORM_WIN32
+  return _ftelli64((FILE*)datasource);
+#else
+  return ftello((FILE*)datasource);
+#endif
+}
+
+// Reads smaller than this are rounded up to a full buffer, reads at least this big go straight into the destination
+static const uint32_t FILESTREAM_BUFSIZE = 16384;
+// The buffer grows to fit reads up to this size so they get read ahead too, anything bigger still goes straight through
+static const uint32_t FILESTREAM_MAXBUFSIZE = 1 << 20;
+
+void tinyoal::filestream_init(FileStream& stream, FILE* file, uint64_t start, uint64_t datalength, bool readahead)
+{
+  stream.file       = file;
+  stream.start      = start;
+  stream.datalength = datalength;
+  stream.pos        = 0;
+  stream.buffer     = 0;
+  stream.bufpos     = 0;
+  stream.buflen     = 0;
+  stream.bufcap     = FILESTREAM_BUFSIZE;
+  stream.ahead      = 0;
+  stream.readahead  = readahead;
+}
+
+// The block being read ahead has to be the same size as the buffer, because they trade places once it's used
+static void _filestream_grow(FileStream& stream, ReadAhead& readahead, size_t len)
+{
+  uint32_t cap = (uint32_t)((len + 4095) & ~(size_t)4095);
+  char* buffer = (char*)realloc(stream.buffer, cap);
+  if(!buffer)
+    return;
+  stream.buffer = buffer;
+  stream.bufcap = cap;
+  if(stream.ahead)
+  {
+    readahead.Cancel(stream.ahead);
+    free(stream.ahead->data);
+    stream.ahead->data = 0;
+  }
+}
+
+// Starts reading whatever comes after the buffer, unless it's already on its way or we're at the end
+static void _filestream_readahead(FileStream& stream, ReadAhead& readahead)
+{
+  uint64_t next = (stream.pos >= stream.bufpos && stream.pos <= stream.bufpos + stream.buflen) ?
+                    stream.bufpos + stream.buflen :
+                    stream.pos;
+  if(next >= stream.datalength)
+    return;
+
+  if(!stream.ahead)
+  {
+    if(!(stream.ahead = TinyOAL::Instance()->AllocViaPool<ReadAheadBlock>()))
+      return;
+    stream.ahead->data    = 0;
+    stream.ahead->pending = false;
+  }
+  ReadAheadBlock* block = stream.ahead;
+  if(block->pending)
+  {
+    if(block->offset == stream.start + next)
+      return;
+    readahead.Cancel(block); // We went somewhere else
+  }
+  if(!block->data && !(block->data = (char*)malloc(stream.bufcap)))
+    return;
+
+  block->file   = stream.file;
+  block->offset = stream.start + next;
+  block->len    = (uint32_t)std::min<uint64_t>(stream.bufcap, stream.datalength - next);
+  readahead.Submit(block);
+}
+
+size_t tinyoal::filestream_read_func(void* ptr, size_t size, size_t nmemb, void* datasource)
+{
+  FileStream* data = (FileStream*)datasource;
+  if(!size || data->pos >= data->datalength)
+    return 0;
+  size_t len            = (size_t)std::min<uint64_t>(size * nmemb, data->datalength - data->pos);
+  char* dst             = (char*)ptr;
+  size_t done           = 0;
+  ReadAhead* readahead  = (!data->readahead || !TinyOAL::Instance()) ? nullptr : TinyOAL::Instance()->GetReadAhead();
+  ReadAheadBlock* block = data->ahead;
+
+  if(readahead && len > data->bufcap && len <= FILESTREAM_MAXBUFSIZE)
+    _filestream_grow(*data, *readahead, len);
+
+  while(done < len)
+  {
+    if(data->pos >= data->bufpos && data->pos < data->bufpos + data->buflen) // Whatever the buffer already has
+    {
+      size_t n = (size_t)std::min<uint64_t>(len - done, data->bufpos + data->buflen - data->pos);
+      memcpy(dst + done, data->buffer + (data->pos - data->bufpos), n);
+      done += n;
+      data->pos += n;
+    }
+    else if(block && block->pending && data->start + data->pos >= block->offset &&
+            data->start + data->pos < block->offset + block->len)
+    { // The block we read ahead has what we need, so it becomes the buffer. It's not pending anymore after this.
+      data->bufpos = block->offset - data->start;
+      data->buflen = readahead->Wait(block);
+      std::swap(data->buffer, block->data);
+    }
+    else if(len - done >= data->bufcap)
+    {
+      size_t n = file_pread(data->file, dst + done, len - done, data->start + data->pos);
+      done += n;
+      data->pos += n;
+      if(!n)
+        break;
+    }
+    else
+    {
+      if(!data->buffer && !(data->buffer = (char*)malloc(data->bufcap)))
+        break;
+      data->bufpos = data->pos;
+      data->buflen = (uint32_t)file_pread(data->file, data->buffer,
+                                          (size_t)std::min<uint64_t>(data->bufcap, data->datalength - data->pos),
+                                          data->start + data->pos);
+      if(!data->buflen)
+        break;
+    }
+  }
+
+  if(readahead)
+    _filestream_readahead(*data, *readahead);
+  return done / size;
+}
+
+int tinyoal::filestream_seek_func(void* datasource, int64_t offset, int whence)
+{
+  FileStream* data = (FileStream*)datasource;
+  int64_t pos;
+
+  switch(whence) // Nothing is read here, the buffer and the block being read ahead stay valid in case we come back
+  {
+  case SEEK_END: pos = (int64_t)data->datalength + offset; break;
+  case SEEK_SET: pos = offset; break;
+  default:
+  case SEEK_CUR: pos = (int64_t)data->pos + offset; break;
+  }
+  if(pos < 0 || (uint64_t)pos > data->datalength)
+    return -1;
+  data->pos = pos;
+  return 0;
+}
+
+int tinyoal::filestream_close_func(void* datasource)
+{
+  FileStream* data = (FileStream*)datasource;
+  if(data->ahead)
+  {
+    TinyOAL::Instance()->GetReadAhead()->Cancel(data->ahead);
+    free(data->ahead->data);
+    TinyOAL::Instance()->DeallocViaPool(data->ahead);
+    data->ahead = 0;
+  }
+  free(data->buffer);
+  data->buffer = 0;
+  data->buflen = 0;
+  return 0; // The FILE* belongs to whoever gave it to us
+}
+
+int64_t tinyoal::filestream_tell_func(void* datasource) { return ((FileStream*)datasource)->pos; }
+
+size_t tinyoal::file_pread(FILE* file, void* ptr, size_t len, uint64_t offset)
+{
+  size_t done = 0;
+#ifdef BUN_PLATFORM_WIN32
+  HANDLE h = (HANDLE)_get_osfhandle(_fileno(file));
+  while(done < len)
+  {
+    OVERLAPPED o = {};
+    o.Offset     = (DWORD)(offset + done);
+    o.OffsetHigh = (DWORD)((offset + done) >> 32);
+    DWORD n      = 0;
+    if(!ReadFile(h, (char*)ptr + done, (DWORD)std::min<size_t>(len - done, 0x40000000), &n, &o) || !n)
+      break;
+    done += n;
+  }
+#else
+  int fd = fileno(file);
+  while(done < len)
+  {
+    ssize_t n = pread(fd, (char*)ptr + done, len - done, (off_t)(offset + done));
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      break;
+    done += n;
+  }
+#endif
+  return done;
+}
\ No newline at end of file
@@ -6,13 +6,12 @@
 #include "tinyoal/TinyOAL.h"
 #include "WaveFunctions.h"
 #include "Engine.h"
+#include "Kernels.h"
 
 using namespace tinyoal;
 
-DatStreamEx* AudioResourceFLAC::_freelist = 0;
-
-AudioResourceFLAC::AudioResourceFLAC(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
-  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_FLAC, loop)
+AudioResourceFLAC::AudioResourceFLAC(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
+  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_FLAC, loop), _freelist(0), _index(&_cbindex, this)
 {
   auto fn         = TinyOAL::Instance()->GetFlac();
   DatStreamEx* ex = (DatStreamEx*)_openstream(true);
@@ -23,14 +22,24 @@ AudioResourceFLAC::AudioResourceFLAC(void* data, uint32_t datalength, TINYOAL_FL
   _freq       = fn->fn_flac_get_sample_rate(ex->d);
   _channels   = fn->fn_flac_get_channels(ex->d);
   _samplebits = fn->fn_flac_get_bits_per_sample(ex->d);
-  if(_samplebits == 24)
+  if(_samplebits == 24 || TinyOAL::Instance()->GetFloatDecode()) // 24-bit always gets converted to float
     _samplebits = 32;
   _bufsize = fn->fn_flac_get_block_size(ex->d) * (_samplebits >> 3) * _channels * 2; // Allocate enough space for 2 blocks
   _format  = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
   _total   = fn->fn_flac_get_total_samples(ex->d);
   CloseStream(ex);
 }
-AudioResourceFLAC::~AudioResourceFLAC() { _destruct(); }
+AudioResourceFLAC::~AudioResourceFLAC()
+{
+  _index.Stop(); // The build reads _data, so it has to finish before anything is freed
+  _destruct();   // Closes every stream, so the entire pool is on the freelist after this
+  while(_freelist)
+  {
+    DatStreamEx* ex = _freelist;
+    _freelist       = _freelist->next;
+    _freestream(ex);
+  }
+}
 void* AudioResourceFLAC::OpenStream() { return _openstream(false); }
 void* AudioResourceFLAC::_openstream(bool empty)
 {
@@ -42,21 +51,24 @@ void* AudioResourceFLAC::_openstream(bool empty)
   }
 
   DatStreamEx* stream = _getstream();
-  stream->p           = &_internal;
+  if(!stream)
+    return 0;
   stream->cursample   = 0;
+  stream->len         = 0;
+  stream->tofloat     = (_samplebits == 32);
+  stream->carrypos = stream->carrylen = stream->skip = 0;
   FLAC__StreamDecoderInitStatus err;
-  stream->stream.datalength = _datalength; // This still works, even for a file, because of DatStream's layout.
 
-  if(_flags & TINYOAL_ISFILE)
+  if(_flags & TINYOAL_ISFILE) // Every stream reads the file through its own cursor
   {
-    fseek((FILE*)_data, 0, SEEK_SET);
-    stream->f = (FILE*)_data;
-    err       = fn->fn_flac_init_stream(stream->d, &_cbfread, &_cbfseek, &_cbftell, &_cblength, &_cbfeof,
+    filestream_init(stream->file, (FILE*)_data, 0, _datalength);
+    err = fn->fn_flac_init_stream(stream->d, &_cbfread, &_cbfseek, &_cbftell, &_cbflength, &_cbfeof,
                                   empty ? &_cbemptywrite : &_cbwrite, &_cbmeta, &_cberror, stream);
   }
   else
   {
     stream->stream.data = stream->stream.streampos = (const char*)_data;
+    stream->stream.datalength                      = _datalength;
     err = fn->fn_flac_init_stream(stream->d, &_cbread, &_cbseek, &_cbtell, &_cblength, &_cbeof,
                                   empty ? &_cbemptywrite : &_cbwrite, &_cbmeta, &_cberror, stream);
   }
@@ -75,25 +87,36 @@ void* AudioResourceFLAC::_openstream(bool empty)
 }
 DatStreamEx* AudioResourceFLAC::_getstream()
 {
-  DatStreamEx* r;
   if(!_freelist)
+    return _newstream();
+  DatStreamEx* r = _freelist;
+  _freelist      = _freelist->next;
+  return r;
+}
+DatStreamEx* AudioResourceFLAC::_newstream()
+{
+  DatStreamEx* r = new DatStreamEx();
+  if(!(r->d = TinyOAL::Instance()->GetFlac()->fn_flac_new()))
   {
-    r    = new DatStreamEx();
-    r->d = TinyOAL::Instance()->GetFlac()->fn_flac_new();
-  }
-  else
-  {
-    r         = _freelist;
-    _freelist = _freelist->next;
+    TINYOAL_LOG(1, "fn_flac_new failed to allocate a decoder");
+    delete r;
+    return 0;
   }
   return r;
 }
+void AudioResourceFLAC::_freestream(DatStreamEx* ex)
+{
+  TinyOAL::Instance()->GetFlac()->fn_flac_delete(ex->d);
+  free(ex->carry);
+  delete ex;
+}
 
-void AudioResourceFLAC::CloseStream(void* stream) { _closestream(stream); }
-void AudioResourceFLAC::_closestream(void* stream)
+void AudioResourceFLAC::CloseStream(void* stream)
 {
   DatStreamEx* ex = (DatStreamEx*)stream;
   TinyOAL::Instance()->GetFlac()->fn_flac_finish(ex->d);
+  if(_flags & TINYOAL_ISFILE)
+    filestream_close_func(&ex->file);
   ex->next  = _freelist;
   _freelist = ex;
 }
@@ -102,22 +125,39 @@ unsigned long AudioResourceFLAC::Read(void* stream, char* buffer, uint32_t len,
   DatStreamEx* ex = (DatStreamEx*)stream;
   auto fn         = TinyOAL::Instance()->GetFlac();
 
-  _internal._len       = len;
-  _internal._buffer    = buffer;
-  _internal._bytesread = 0;
-  while(_internal._len > 0 && !(eof = (fn->fn_flac_get_state(ex->d) >= FLAC__STREAM_DECODER_END_OF_STREAM)))
-    fn->fn_flac_process_single(ex->d);
-  _internal._len = 0;
-
-  if(_internal._cursample != -1LL &&
-     !eof) //_cursample gets set by our write callback. If it's -1, then we didn't need to terminate early.
-    if(!fn->fn_flac_seek(ex->d, _internal._cursample))
-      TINYOAL_LOG(4, "fn_flac_seek failed to seek to %llu", _internal._cursample);
-  return _internal._bytesread;
+  ex->len       = len;
+  ex->buffer    = buffer;
+  ex->bytesread = 0;
+  eof           = false;
+  _drain(ex); // Hand out whatever was left over from the last frame before decoding anything new
+
+  // Only decode another frame once the carry-over buffer is empty, otherwise we'd overwrite samples we haven't delivered
+  while(ex->len > 0 && ex->carrypos == ex->carrylen &&
+        !(eof = (fn->fn_flac_get_state(ex->d) >= FLAC__STREAM_DECODER_END_OF_STREAM)))
+    if(!fn->fn_flac_process_single(ex->d))
+      break;
+  ex->len = 0;
+  return ex->bytesread;
+}
+void AudioResourceFLAC::_drain(DatStreamEx* ex)
+{
+  uint32_t bytes = ex->carrylen - ex->carrypos;
+  if(!bytes || ex->len < ex->carryframe)
+    return;
+  if(bytes > ex->len)
+    bytes = ex->len - (ex->len % ex->carryframe); // Only ever hand out whole samples
+
+  memcpy(ex->buffer, ex->carry + ex->carrypos, bytes);
+  ex->carrypos += bytes;
+  ex->bytesread += bytes;
+  ex->buffer += bytes;
+  ex->len -= bytes;
+  ex->cursample += bytes / ex->carryframe;
 }
 bool AudioResourceFLAC::Reset(void* stream)
 {
   ((DatStreamEx*)stream)->cursample = 0;
+  ((DatStreamEx*)stream)->carrypos = ((DatStreamEx*)stream)->carrylen = ((DatStreamEx*)stream)->skip = 0;
   if(TinyOAL::Instance()->GetFlac()->fn_flac_reset(((DatStreamEx*)stream)->d) != 0)
     return true;
   TINYOAL_LOG(2, "fn_flac_reset failed");
@@ -125,18 +165,79 @@ bool AudioResourceFLAC::Reset(void* stream)
 }
 bool AudioResourceFLAC::Skip(void* stream, uint64_t samples)
 {
-  _internal._len = 0; // Because FLAC was written by morons we have to make sure we don't go writing random shit willy-nilly
+  DatStreamEx* ex = (DatStreamEx*)stream;
+  auto fn         = TinyOAL::Instance()->GetFlac();
+  ex->len         = 0; // Because FLAC was written by morons we have to make sure we don't go writing random shit willy-nilly
   if(!samples)
     return Reset(stream);
-  ((DatStreamEx*)stream)->cursample = samples;
-  if(TinyOAL::Instance()->GetFlac()->fn_flac_seek(((DatStreamEx*)stream)->d, samples) != 0)
+  ex->cursample = samples;
+  ex->carrypos = ex->carrylen = ex->skip = 0; // The seek target frame lands in here
+
+  _index.Request(); // Until the indexer gets to it, this seek and any after it use fn_flac_seek
+  if(const SeekIndex::Point* p = _index.Find(samples))
+  { // Jump straight to the frame holding the target, then let _cbwrite throw away the samples in front of it
+    bool moved = (_flags & TINYOAL_ISFILE) ? !filestream_seek_func(&ex->file, (int64_t)p->offset, SEEK_SET) :
+                                             !dat_seek_func(&ex->stream, (int64_t)p->offset, SEEK_SET);
+    if(moved && fn->fn_flac_flush(ex->d))
+    {
+      ex->skip = (uint32_t)std::min<uint64_t>(samples - p->sample, UINT32_MAX);
+      return true;
+    }
+  }
+
+  if(fn->fn_flac_seek(ex->d, samples) != 0)
     return true;
   TINYOAL_LOG(2, "fn_flac_seek failed to seek to %llu", samples);
-  if(TinyOAL::Instance()->GetFlac()->fn_flac_get_state(((DatStreamEx*)stream)->d) == FLAC__STREAM_DECODER_SEEK_ERROR)
+  if(fn->fn_flac_get_state(ex->d) == FLAC__STREAM_DECODER_SEEK_ERROR)
     Reset(stream); // FLAC requires us to reset or flush the stream if seeking fails with FLAC__STREAM_DECODER_SEEK_ERROR
   return false;
 }
 uint64_t AudioResourceFLAC::Tell(void* stream) { return ((DatStreamEx*)stream)->cursample; }
+void AudioResourceFLAC::_cbindex(void* owner, std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel)
+{
+  ((AudioResourceFLAC*)owner)->_buildindex(points, cancel);
+}
+// Runs on the indexer thread, so this can't use the freelist, the read-ahead thread, or the log. It gets a decoder of its
+// own that reads through a FileStream with read-ahead turned off, and reports errors to a callback that ignores them.
+void AudioResourceFLAC::_buildindex(std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel)
+{
+  auto fn        = TinyOAL::Instance()->GetFlac();
+  DatStreamEx ex = {};
+  if(!(ex.d = fn->fn_flac_new()))
+    return;
+
+  FLAC__StreamDecoderInitStatus err;
+  if(_flags & TINYOAL_ISFILE)
+  {
+    filestream_init(ex.file, (FILE*)_data, 0, _datalength, false);
+    err = fn->fn_flac_init_stream(ex.d, &_cbfread, &_cbfseek, &_cbftell, &_cbflength, &_cbfeof, &_cbemptywrite,
+                                  &_cbmeta, &_cbquieterror, &ex);
+  }
+  else
+  {
+    ex.stream.data = ex.stream.streampos = (const char*)_data;
+    ex.stream.datalength                 = _datalength;
+    err = fn->fn_flac_init_stream(ex.d, &_cbread, &_cbseek, &_cbtell, &_cblength, &_cbeof, &_cbemptywrite, &_cbmeta,
+                                  &_cbquieterror, &ex);
+  }
+
+  if(!err && fn->fn_flac_process_until_metadata_end(ex.d))
+  { // Skipping a frame only parses its header and finds where it ends, so this never decodes any audio
+    uint64_t sample = 0;
+    FLAC__uint64 offset;
+    while(!cancel.load(std::memory_order_relaxed) && fn->fn_flac_get_decoder_position(ex.d, &offset) &&
+          fn->fn_flac_skip(ex.d) && fn->fn_flac_get_state(ex.d) < FLAC__STREAM_DECODER_END_OF_STREAM)
+    {
+      points.push_back({ sample, offset });
+      sample += fn->fn_flac_get_block_size(ex.d);
+    }
+  }
+
+  fn->fn_flac_finish(ex.d);
+  if(_flags & TINYOAL_ISFILE)
+    filestream_close_func(&ex.file);
+  fn->fn_flac_delete(ex.d);
+}
 void AudioResourceFLAC::_cberror(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status,
                                  void* client_data)
 {
@@ -157,6 +258,9 @@ void AudioResourceFLAC::_cberror(const FLAC__StreamDecoder* decoder, FLAC__Strea
   default: TINYOAL_LOG(2, "Unknown FLAC CODEC ERROR %i", (int)status);
   }
 }
+void AudioResourceFLAC::_cbquieterror(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status,
+                                      void* client_data)
+{} // A stream that hits a bad frame while playing logs it through _cberror anyway
 void AudioResourceFLAC::_cbmeta(const FLAC__StreamDecoder* decoder, const FLAC__StreamMetadata* metadata, void* client_data)
 {}
 
@@ -170,70 +274,92 @@ BUN_FORCEINLINE void r_flacread(T* target, const FLAC__int32* const buffer[], ui
     target += channels;
   }
 }
-template<>
-BUN_FORCEINLINE void r_flacread<float>(float* target, const FLAC__int32* const buffer[], uint32_t num,
-                                       uint32_t channels)
+BUN_FORCEINLINE void r_flacreadfloat(float* target, const FLAC__int32* const buffer[], uint32_t num, uint32_t channels,
+                                     float scale)
 {
   for(uint32_t i = 0; i < num; i += 1)
   {
     for(uint32_t j = 0; j < channels; ++j)
-      target[j] = (float)buffer[j][i] / 8388607.0f;
+      target[j] = (float)buffer[j][i] * scale;
     target += channels;
   }
 }
+// If bits is 32, the samples are converted to floats and multiplied by scale, no matter what the source bit depth is
+BUN_FORCEINLINE void r_flacconvert(char* target, const FLAC__int32* const buffer[], uint32_t num, uint32_t channels,
+                                   uint32_t bits, float scale)
+{ // Mono and stereo go through the SIMD kernels, which interleave and convert in a single pass
+  const Kernels& k = Kernels::Get();
+  switch(bits)
+  {
+  case 8: r_flacread<char>(reinterpret_cast<char*>(target), buffer, num, channels); break;
+  case 16:
+    if(channels == 1)
+      k.PlanarToS16Mono(reinterpret_cast<int16_t*>(target), buffer[0], num);
+    else if(channels == 2)
+      k.PlanarToS16Stereo(reinterpret_cast<int16_t*>(target), buffer[0], buffer[1], num);
+    else
+      r_flacread<short>(reinterpret_cast<short*>(target), buffer, num, channels);
+    break;
+  case 32:
+    if(channels == 1)
+      k.PlanarToFloatMono(reinterpret_cast<float*>(target), buffer[0], num, scale);
+    else if(channels == 2)
+      k.PlanarToFloatStereo(reinterpret_cast<float*>(target), buffer[0], buffer[1], num, scale);
+    else
+      r_flacreadfloat(reinterpret_cast<float*>(target), buffer, num, channels, scale);
+    break;
+  }
+}
 FLAC__StreamDecoderWriteStatus AudioResourceFLAC::_cbwrite(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame,
                                                            const FLAC__int32* const buffer[], void* client_data)
 {
-  INTERNAL* self        = *(INTERNAL**)client_data;
-  uint32_t channels = frame->header.channels;
-  uint32_t num      = frame->header.blocksize;
-  if(num == 1)
-    num = 192;
-  else if(num >= 2 && num <= 5)
-    num = 576 * (1 << (num - 2));
-  else if(num >= 8 && num <= 15)
-    num = 256 * (1 << (num - 8));
-
-  uint32_t bits      = frame->header.bits_per_sample == 24 ? 32 : frame->header.bits_per_sample;
+  DatStreamEx* ex    = (DatStreamEx*)client_data;
+  uint32_t channels  = frame->header.channels;
+  uint32_t num       = frame->header.blocksize; // libFLAC has already decoded this into an actual sample count
+  uint32_t bits      = ex->tofloat ? 32 : frame->header.bits_per_sample;
   uint32_t persample = channels * (bits >> 3);
-  uint32_t len       = self->_len / persample;
+  uint32_t bytes     = num * persample;
+  float scale        = 1.0f / (float)(1ULL << (frame->header.bits_per_sample - 1)); // Maps the source range to [-1, 1)
 
-  if(num > len)
+  if(ex->skip >= num) // Only happens if we were asked to skip past the end of the stream
   {
-    self->_len = 0;
+    ex->skip -= num;
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
   }
-
-  uint32_t bytes = num * persample;
-  switch(bits)
+  if(bytes <= ex->len && !ex->skip)
   {
-  case 8: r_flacread<char>(reinterpret_cast<char*>(self->_buffer), buffer, num, channels); break;
-  case 16: r_flacread<short>(reinterpret_cast<short*>(self->_buffer), buffer, num, channels); break;
-  case 24: // 24-bit gets converted to 32-bit
-  case 32: r_flacread<float>(reinterpret_cast<float*>(self->_buffer), buffer, num, channels); break;
+    r_flacconvert(ex->buffer, buffer, num, channels, bits, scale);
+    ex->bytesread += bytes;
+    ex->buffer += bytes;
+    ex->len -= bytes;
+    ex->cursample += num;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
   }
 
-  self->_bytesread += bytes;
-  self->_buffer += bytes;
-  self->_len -= bytes;
-  ((DatStreamEx*)client_data)->cursample += num;
-  self->_cursample = (self->_len > 0) ? ((DatStreamEx*)client_data)->cursample : (uint64_t)-1;
-
+  // The frame doesn't fit, so decode all of it into the carry-over buffer, hand out what fits, and keep the rest for the
+  // next Read. This avoids seeking back and decoding the same frame twice. It's also how we drop the samples in front of
+  // an indexed seek target.
+  if(bytes > ex->carrycap)
+  {
+    char* carry = (char*)realloc(ex->carry, bytes);
+    if(!carry)
+    {
+      TINYOAL_LOG(1, "Failed to allocate %u byte FLAC carry-over buffer", bytes);
+      return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+    ex->carry    = carry;
+    ex->carrycap = bytes;
+  }
+  r_flacconvert(ex->carry, buffer, num, channels, bits, scale);
+  ex->carrypos   = ex->skip * persample;
+  ex->skip       = 0;
+  ex->carrylen   = bytes;
+  ex->carryframe = persample;
+  _drain(ex);
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
-size_t AudioResourceFLAC::__flac_fseek_offset =
-  0; // Special seek function that properly deals with external FILE* handles we can get in ToWave
-FLAC__StreamDecoderSeekStatus AudioResourceFLAC::_cbfseekoffset(const FLAC__StreamDecoder* decoder,
-                                                                FLAC__uint64 absolute_byte_offset, void* client_data)
-{
-  if(fseek(((DatStreamEx*)client_data)->f, absolute_byte_offset + __flac_fseek_offset, SEEK_SET) < 0)
-    return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
-  else
-    return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
-}
-
-size_t AudioResourceFLAC::Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop)
+size_t AudioResourceFLAC::Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop)
 {
   if(p)
     new(p) AudioResourceFLAC(data, datalength, flags, loop);
@@ -241,9 +367,9 @@ size_t AudioResourceFLAC::Construct(void* p, void* data, uint32_t datalength, TI
 }
 bool AudioResourceFLAC::ScanHeader(const char* fileheader) { return !strncmp(fileheader, "fLaC", 4); }
 
-std::pair<void*, uint32_t> AudioResourceFLAC::ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags)
+std::pair<void*, uint64_t> AudioResourceFLAC::ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags)
 {
-  static const std::pair<void*, uint32_t> NULLRET(nullptr, 0);
+  static const std::pair<void*, uint64_t> NULLRET(nullptr, 0);
   auto fn = TinyOAL::Instance()->GetFlac();
   if(!fn)
   {
@@ -251,26 +377,25 @@ std::pair<void*, uint32_t> AudioResourceFLAC::ToWave(void* data, uint32_t datale
     return NULLRET;
   }
 
-  DatStreamEx* stream = _getstream();
+  DatStreamEx* stream = _newstream(); // There's no resource to pool this with, so we get a temporary decoder
   if(!stream)
     return NULLRET;
 
-  INTERNAL internal;
-  stream->p         = &internal; // Note: This is safe because we close the stream before the end of the scope.
   stream->cursample = 0;
+  stream->len       = 0;
+  stream->carrypos = stream->carrylen = 0;
   FLAC__StreamDecoderInitStatus err;
-  stream->stream.datalength = datalength;
 
-  if(flags & TINYOAL_ISFILE)
+  if(flags & TINYOAL_ISFILE) // External FILE* handles are decoded from wherever they were left
   {
-    __flac_fseek_offset = ftell((FILE*)data);
-    stream->f           = (FILE*)data;
-    err = fn->fn_flac_init_stream(stream->d, &_cbfread, &_cbfseekoffset, &_cbftell, &_cblength, &_cbfeof, &_cbwrite,
+    filestream_init(stream->file, (FILE*)data, file_tell_func(data), datalength);
+    err = fn->fn_flac_init_stream(stream->d, &_cbfread, &_cbfseek, &_cbftell, &_cbflength, &_cbfeof, &_cbwrite,
                                   &_cbmeta, &_cberror, stream);
   }
   else
   {
     stream->stream.data = stream->stream.streampos = (const char*)data;
+    stream->stream.datalength                      = datalength;
     err = fn->fn_flac_init_stream(stream->d, &_cbread, &_cbseek, &_cbtell, &_cblength, &_cbeof, &_cbwrite, &_cbmeta,
                                   &_cberror, stream);
   }
@@ -278,37 +403,52 @@ std::pair<void*, uint32_t> AudioResourceFLAC::ToWave(void* data, uint32_t datale
   if(err != 0)
   {
     TINYOAL_LOG(2, "fn_flac_init_stream failed with error code %i", (int)err);
-    _closestream(stream);
+    if(flags & TINYOAL_ISFILE)
+      filestream_close_func(&stream->file);
+    _freestream(stream);
     return NULLRET;
   }
 
   if(!fn->fn_flac_process_until_metadata_end(stream->d))
     TINYOAL_LOG(4, "fn_flac_process_until_metadata_end failed in _openstream()");
 
-  internal._len = 0;
-
   if(!fn->fn_flac_process_single(stream->d)) // Lets us pick up all this metadata
     TINYOAL_LOG(2, "Failed to preprocess first frame");
 
   uint32_t channels   = fn->fn_flac_get_channels(stream->d);
   uint32_t samplebits = fn->fn_flac_get_bits_per_sample(stream->d);
-  if(samplebits == 24)
+  if(samplebits == 24 || TinyOAL::Instance()->GetFloatDecode())
     samplebits = 32;
   uint32_t freq   = fn->fn_flac_get_sample_rate(stream->d);
   uint64_t total      = fn->fn_flac_get_total_samples(stream->d);
   uint64_t totalbytes = total * channels * (samplebits >> 3);
+  if(totalbytes > UINT32_MAX) // The decoder hands out 32-bit lengths
+  {
+    TINYOAL_LOG(1, "Stream is too long to decode into memory");
+    fn->fn_flac_finish(stream->d);
+    if(flags & TINYOAL_ISFILE)
+      filestream_close_func(&stream->file);
+    _freestream(stream);
+    return NULLRET;
+  }
   uint32_t header = TinyOAL::Instance()->GetWave()->WriteHeader(0, 0, 0, 0, 0);
-  char* buffer        = (char*)malloc(totalbytes + header);
+  char* buffer        = (char*)malloc((size_t)totalbytes + header);
   assert(buffer != 0);
   TinyOAL::Instance()->GetFlac()->fn_flac_reset(stream->d);
-  internal._len       = totalbytes;
-  internal._buffer    = buffer + header;
-  internal._bytesread = 0;
+  stream->carrypos = stream->carrylen = 0; // Throw away the first frame we decoded above
+  stream->len       = (uint32_t)totalbytes;
+  stream->tofloat   = (samplebits == 32);
+  stream->buffer    = buffer + header;
+  stream->bytesread = 0;
   fn->fn_flac_process_until_stream_end(stream->d);
-  TinyOAL::Instance()->GetWave()->WriteHeader(buffer, internal._bytesread + header, channels, samplebits, freq);
+  uint32_t bytesread = stream->bytesread;
+  TinyOAL::Instance()->GetWave()->WriteHeader(buffer, bytesread + header, channels, samplebits, freq);
 
-  _closestream(stream);
-  return std::pair<void*, uint32_t>(buffer, internal._bytesread + header);
+  fn->fn_flac_finish(stream->d);
+  if(flags & TINYOAL_ISFILE)
+    filestream_close_func(&stream->file);
+  _freestream(stream);
+  return std::pair<void*, uint64_t>(buffer, bytesread + header);
 }
 FLAC__StreamDecoderWriteStatus AudioResourceFLAC::_cbemptywrite(const FLAC__StreamDecoder* decoder,
                                                                 const FLAC__Frame* frame, const FLAC__int32* const buffer[],
@@ -342,7 +482,7 @@ FLAC__StreamDecoderSeekStatus AudioResourceFLAC::_cbseek(const FLAC__StreamDecod
 FLAC__StreamDecoderTellStatus AudioResourceFLAC::_cbtell(const FLAC__StreamDecoder* decoder,
                                                          FLAC__uint64* absolute_byte_offset, void* client_data)
 {
-  long pos;
+  int64_t pos;
   if((pos = dat_tell_func(&((DatStreamEx*)client_data)->stream)) < 0)
     return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
 
@@ -365,7 +505,7 @@ FLAC__StreamDecoderReadStatus AudioResourceFLAC::_cbfread(const FLAC__StreamDeco
 {
   if(*bytes > 0)
   {
-    *bytes = fread(buffer, sizeof(FLAC__byte), *bytes, ((DatStreamEx*)client_data)->f);
+    *bytes = filestream_read_func(buffer, sizeof(FLAC__byte), *bytes, &((DatStreamEx*)client_data)->file);
     if(*bytes == 0)
       return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
     else
@@ -377,7 +517,7 @@ FLAC__StreamDecoderReadStatus AudioResourceFLAC::_cbfread(const FLAC__StreamDeco
 FLAC__StreamDecoderSeekStatus AudioResourceFLAC::_cbfseek(const FLAC__StreamDecoder* decoder,
                                                           FLAC__uint64 absolute_byte_offset, void* client_data)
 {
-  if(fseek(((DatStreamEx*)client_data)->f, absolute_byte_offset, SEEK_SET) < 0)
+  if(filestream_seek_func(&((DatStreamEx*)client_data)->file, (int64_t)absolute_byte_offset, SEEK_SET) < 0)
     return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
   else
     return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
@@ -385,14 +525,17 @@ FLAC__StreamDecoderSeekStatus AudioResourceFLAC::_cbfseek(const FLAC__StreamDeco
 FLAC__StreamDecoderTellStatus AudioResourceFLAC::_cbftell(const FLAC__StreamDecoder* decoder,
                                                           FLAC__uint64* absolute_byte_offset, void* client_data)
 {
-  long pos;
-  if((pos = ftell(((DatStreamEx*)client_data)->f)) < 0)
-    return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
-
-  *absolute_byte_offset = (FLAC__uint64)pos;
+  *absolute_byte_offset = (FLAC__uint64)filestream_tell_func(&((DatStreamEx*)client_data)->file);
   return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
+FLAC__StreamDecoderLengthStatus AudioResourceFLAC::_cbflength(const FLAC__StreamDecoder* decoder,
+                                                              FLAC__uint64* stream_length, void* client_data)
+{
+  *stream_length = ((DatStreamEx*)client_data)->file.datalength;
+  return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
 FLAC__bool AudioResourceFLAC::_cbfeof(const FLAC__StreamDecoder* decoder, void* client_data)
 {
-  return feof(((DatStreamEx*)client_data)->f);
+  FileStream& file = ((DatStreamEx*)client_data)->file;
+  return file.pos >= file.datalength;
 }
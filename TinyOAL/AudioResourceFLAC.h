@@ -8,6 +8,7 @@
 
 #include "tinyoal/AudioResource.h"
 #include "FlacFunctions.h"
+#include "SeekIndex.h"
 
 namespace tinyoal {
   struct DatStreamEx;
@@ -17,7 +18,7 @@ namespace tinyoal {
   {
   public:
     AudioResourceFLAC(const AudioResourceFLAC& copy);
-    AudioResourceFLAC(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    AudioResourceFLAC(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     ~AudioResourceFLAC();
     virtual void* OpenStream();             // This returns a pointer to the internal stream on success, or NULL on failure
     virtual void CloseStream(void* stream); // This closes an AUDIOSTREAM pointer
@@ -27,12 +28,14 @@ namespace tinyoal {
     virtual bool Skip(void* stream, uint64_t samples); // Sets a stream to given sample
     virtual uint64_t Tell(void* stream);               // Gets what sample a stream is currently on
 
-    static size_t Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    static size_t Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     static bool ScanHeader(const char* fileheader);
-    static std::pair<void*, uint32_t> ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags);
+    static std::pair<void*, uint64_t> ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags);
 
   protected:
     static void _cberror(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* client_data);
+    static void _cbquieterror(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status,
+                              void* client_data);
     static void _cbmeta(const FLAC__StreamDecoder* decoder, const FLAC__StreamMetadata* metadata, void* client_data);
     static FLAC__StreamDecoderWriteStatus _cbwrite(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame,
                                                    const FLAC__int32* const buffer[], void* client_data);
@@ -51,35 +54,42 @@ namespace tinyoal {
                                                   void* client_data);
     static FLAC__StreamDecoderSeekStatus _cbfseek(const FLAC__StreamDecoder* decoder, FLAC__uint64 absolute_byte_offset,
                                                   void* client_data);
-    static FLAC__StreamDecoderSeekStatus _cbfseekoffset(const FLAC__StreamDecoder* decoder,
-                                                        FLAC__uint64 absolute_byte_offset, void* client_data);
     static FLAC__StreamDecoderTellStatus _cbftell(const FLAC__StreamDecoder* decoder, FLAC__uint64* absolute_byte_offset,
                                                   void* client_data);
+    static FLAC__StreamDecoderLengthStatus _cbflength(const FLAC__StreamDecoder* decoder, FLAC__uint64* stream_length,
+                                                      void* client_data);
     static FLAC__bool _cbfeof(const FLAC__StreamDecoder* decoder, void* client_data);
     void* _openstream(bool empty);
-    static DatStreamEx* _getstream();
-    static void _closestream(void* stream);
+    DatStreamEx* _getstream();
+    static DatStreamEx* _newstream();
+    static void _freestream(DatStreamEx* ex);
+    static void _drain(DatStreamEx* ex);
+    static void _cbindex(void* owner, std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel);
+    void _buildindex(std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel);
 
-    struct INTERNAL
-    {
-      char* _buffer;
-      uint32_t _bytesread;
-      uint32_t _len;
-      uint64_t _cursample;
-    } _internal;
-    static DatStreamEx* _freelist;
-    static size_t __flac_fseek_offset;
+    DatStreamEx* _freelist; // Pooled decoders that belong to this resource
+    SeekIndex _index;       // Byte offset of every frame, built in the background after the first seek
   };
 
+  // All the state the write callback touches lives here, so every stream on a resource can be decoded independently
   struct DatStreamEx
   {
-    void* p; // INTERNAL* pointer
     FLAC__StreamDecoder* d;
     uint64_t cursample;
+    char* buffer; // Current output buffer and how much of it is left, only valid during Read()
+    uint32_t bytesread;
+    uint32_t len;
+    char* carry; // Decoded samples from the last frame that didn't fit in the output buffer
+    uint32_t carrycap;
+    uint32_t carrypos;
+    uint32_t carrylen;
+    uint32_t carryframe; // Size of a single multichannel sample in the carry buffer
+    uint32_t skip;       // Samples to throw away from the front of the next frame after an indexed seek
+    bool tofloat;        // Decode to floats regardless of the source bit depth
     union
     {
       DatStream stream;
-      FILE* f;
+      FileStream file; // Closed when the stream goes back on the freelist
       DatStreamEx* next;
     };
   };
@@ -9,44 +9,73 @@
 
 using namespace tinyoal;
 
-AudioResourceMP3::AudioResourceMP3(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
-  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_MP3, loop)
+AudioResourceMP3::AudioResourceMP3(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
+  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_MP3, loop), _pooled(0), _index(0), _indexstep(0),
+  _indexfill(0)
 {
-  mpg123_handle* h = (mpg123_handle*)OpenStream();
+  long freq;
+  int channels, enc;
+  mpg123_handle* h = _openstream(&freq, &channels, &enc, TinyOAL::Instance()->GetFloatDecode());
   if(!h)
     return;
-  int enc   = 0;
-  long freq = _freq;
-  int err   = TinyOAL::Instance()->GetMp3()->fn_mpgGetFormat(h, &freq, (int*)&_channels, &enc);
-  if(!err)
-    err = TinyOAL::Instance()->GetMp3()->fn_mpgFormatNone(h); // Lock format so it doesn't change
-  if(!err)
-    err = TinyOAL::Instance()->GetMp3()->fn_mpgFormat(h, freq, (int)_channels, enc);
-  _freq = freq;
-  if(err != MPG123_OK)
-    TINYOAL_LOG(1, "Failed to get format information from MP3");
-  else
+  _freq       = freq;
+  _channels   = channels;
+  _samplebits = (enc == MPG123_ENC_SIGNED_16) ? 16 : 32;
+  _format     = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+  _bufsize    = (_freq * _channels * (_samplebits >> 3)) >>
+             2; // Sets buffer size to 250 ms, which is freq * bytes per sample / 4 (quarter of a second)
+  _bufsize -= (_bufsize % (_channels * (_samplebits >> 3)));
+  _total = TinyOAL::Instance()->GetMp3()->fn_mpgLength(
+    h); // OpenStream already called mpgScan so this value will be as accurate as we can get.
+
+  // Keep a copy of the frame index the scan built so every stream we open afterwards can reuse it instead of reading the
+  // entire file again. The index belongs to the handle, so it has to be copied out before we close it.
+  auto fn = TinyOAL::Instance()->GetMp3();
+  off_t* index;
+  off_t step;
+  size_t fill;
+  if(fn->fn_mpgIndex && fn->fn_mpgSetIndex && fn->fn_mpgIndex(h, &index, &step, &fill) == MPG123_OK && fill > 0)
   {
-    _samplebits = (enc == MPG123_ENC_SIGNED_16) ? 16 : 32;
-    _format     = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
-    _bufsize    = (_freq * _channels * (_samplebits >> 3)) >>
-               2; // Sets buffer size to 250 ms, which is freq * bytes per sample / 4 (quarter of a second)
-    _bufsize -= (_bufsize % (_channels * (_samplebits >> 3)));
-    _total = TinyOAL::Instance()->GetMp3()->fn_mpgLength(
-      h); // OpenStream already called mpgScan so this value will be as accurate as we can get.
+    if((_index = (off_t*)malloc(fill * sizeof(off_t))) != nullptr)
+    {
+      memcpy(_index, index, fill * sizeof(off_t));
+      _indexstep = step;
+      _indexfill = fill;
+    }
   }
   CloseStream(h);
 }
 
-AudioResourceMP3::~AudioResourceMP3() { _destruct(); }
+AudioResourceMP3::~AudioResourceMP3()
+{
+  _destruct(); // Closes every stream, so all the handles we're going to keep are in the pool after this
+  while(_pooled > 0)
+    _deletestream(_pool[--_pooled]);
+  free(_index);
+}
 
 void* AudioResourceMP3::OpenStream()
+{
+  while(_pooled > 0) // An already opened handle only needs to be seeked back to the start
+  {
+    mpg123_handle* h = _pool[--_pooled];
+    if(Reset(h))
+      return h;
+    _deletestream(h);
+  }
+
+  long freq;
+  int channels, enc;
+  return _openstream(&freq, &channels, &enc, _samplebits == 32); // Every stream has to match the format we picked
+}
+
+mpg123_handle* AudioResourceMP3::_openstream(long* freq, int* channels, int* enc, bool tofloat)
 {
   auto fn = TinyOAL::Instance()->GetMp3();
   if(!fn)
     return 0;
   int err;
-  mpg123_handle* h = fn->fn_mpgNew(0, &err);
+  mpg123_handle* h = fn->New(&err);
 
   if(!h || err != MPG123_OK)
   {
@@ -55,11 +84,7 @@ void* AudioResourceMP3::OpenStream()
   }
 
   if(_flags & TINYOAL_ISFILE)
-  {
-    fseek((FILE*)_data, 0, SEEK_SET); // If we're a file, reset the pointer
-    fn->fn_mpgReplaceReader(h, &cb_fileread, &cb_fileseek, 0);
-    err = fn->fn_mpgOpenHandle(h, _data);
-  }
+    err = _openfile(h, (FILE*)_data, 0, _datalength);
   else
   {
     DatStream* dat = TinyOAL::Instance()->AllocViaPool<DatStream>();
@@ -76,14 +101,51 @@ void* AudioResourceMP3::OpenStream()
     fn->fn_mpgDelete(h);
     return 0;
   }
-  fn->fn_mpgScan(h);
+  if(!_index || fn->fn_mpgSetIndex(h, _index, _indexstep, _indexfill) != MPG123_OK)
+    fn->fn_mpgScan(h); // Only the first stream has to scan the file, after that we have a cached index
+  if(_lockformat(h, freq, channels, enc, tofloat) != MPG123_OK)
+  {
+    TINYOAL_LOG(1, "Failed to get format information from MP3");
+    fn->fn_mpgClose(h);
+    fn->fn_mpgDelete(h);
+    return 0;
+  }
   return h;
 }
 
+// Locks the output format so it can't change mid-stream, switching the output to floats if tofloat is set. mpg123
+// decodes in float internally, so this skips its conversion to 16-bit entirely.
+int AudioResourceMP3::_lockformat(mpg123_handle* h, long* freq, int* channels, int* enc, bool tofloat)
+{
+  auto fn = TinyOAL::Instance()->GetMp3();
+  int err = fn->fn_mpgGetFormat(h, freq, channels, enc);
+  if(!err)
+    err = fn->fn_mpgFormatNone(h);
+  if(!err && tofloat)
+  {
+    if(fn->fn_mpgFormat(h, *freq, *channels, MPG123_ENC_FLOAT_32) == MPG123_OK)
+    {
+      *enc = MPG123_ENC_FLOAT_32;
+      return MPG123_OK;
+    }
+    TINYOAL_LOG(2, "This mpg123 build can't output floats, falling back to the default encoding");
+  }
+  if(!err)
+    err = fn->fn_mpgFormat(h, *freq, *channels, *enc);
+  return err;
+}
+
 void AudioResourceMP3::CloseStream(void* stream)
 {
-  auto fn          = TinyOAL::Instance()->GetMp3();
   mpg123_handle* h = (mpg123_handle*)stream;
+  if(_pooled < POOLSIZE)
+    _pool[_pooled++] = h;
+  else
+    _deletestream(h);
+}
+void AudioResourceMP3::_deletestream(mpg123_handle* h)
+{
+  auto fn = TinyOAL::Instance()->GetMp3();
   fn->fn_mpgClose(h);
   fn->fn_mpgDelete(h);
 }
@@ -110,7 +172,7 @@ unsigned long AudioResourceMP3::_read(void* stream, char* buffer, uint32_t len,
   eof = (err == MPG123_DONE);
   if(err != MPG123_DONE && err != 0)
     TINYOAL_LOG(1, "Error while decoding mp3");
-  return done;
+  return total;
 }
 
 unsigned long AudioResourceMP3::Read(void* stream, char* buffer, uint32_t len, bool& eof)
@@ -131,23 +193,7 @@ bool AudioResourceMP3::Skip(void* stream, uint64_t samples)
 
 uint64_t AudioResourceMP3::Tell(void* stream) { return TinyOAL::Instance()->GetMp3()->fn_mpgTell((mpg123_handle*)stream); }
 
-off_t __mp3_foffset;
-off_t __mp3_flength;
-off_t AudioResourceMP3::cb_fileseekoffset(void* stream, off_t off, int loc)
-{
-  if(loc == SEEK_END)
-  {
-    loc = SEEK_SET;
-    off += __mp3_flength;
-  }
-  if(loc == SEEK_SET)
-    off += __mp3_foffset;
-  if(!fseek((FILE*)stream, off, loc))
-    return ftell((FILE*)stream);
-  return -1;
-}
-
-size_t AudioResourceMP3::Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop)
+size_t AudioResourceMP3::Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop)
 {
   if(p)
     new(p) AudioResourceMP3(data, datalength, flags, loop);
@@ -158,27 +204,21 @@ bool AudioResourceMP3::ScanHeader(const char* fileheader)
   return !strncmp(fileheader, "ID3", 3) || 0x3FF == (0x3FF & (*(uint16_t*)fileheader));
 }
 
-std::pair<void*, uint32_t> AudioResourceMP3::ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags)
+std::pair<void*, uint64_t> AudioResourceMP3::ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags)
 {
   auto fn = TinyOAL::Instance()->GetMp3();
   int err;
   mpg123_handle* h;
 
-  if(!fn || !(h = fn->fn_mpgNew(0, &err)) || err != MPG123_OK)
+  if(!fn || !(h = fn->New(&err)) || err != MPG123_OK)
   {
     TINYOAL_LOG(1, "Failed to create new mpg instance");
-    return std::pair<void*, uint32_t>((void*)0, 0);
+    return std::pair<void*, uint64_t>((void*)0, 0);
   }
 
   DatStream dat;
-  if(flags & TINYOAL_ISFILE)
-  {
-    // fseek((FILE*)data,0,SEEK_SET); // we don't do this in here because we could have gotten an external file pointer.
-    __mp3_foffset = ftell((FILE*)data);
-    __mp3_flength = datalength;
-    fn->fn_mpgReplaceReader(h, &cb_fileread, &cb_fileseekoffset, 0);
-    err = fn->fn_mpgOpenHandle(h, data);
-  }
+  if(flags & TINYOAL_ISFILE) // We could have gotten an external file pointer, so start from wherever it was left
+    err = _openfile(h, (FILE*)data, file_tell_func(data), datalength);
   else
   {
     dat.data = dat.streampos = (char*)data;
@@ -187,11 +227,11 @@ std::pair<void*, uint32_t> AudioResourceMP3::ToWave(void* data, uint32_t datalen
     err = fn->fn_mpgOpenHandle(h, &dat);
   }
 
-  auto fnabort = [](mpg123_handle* h, const char* error) -> std::pair<void*, uint32_t> {
+  auto fnabort = [](mpg123_handle* h, const char* error) -> std::pair<void*, uint64_t> {
     TINYOAL_LOG(1, error);
     TinyOAL::Instance()->GetMp3()->fn_mpgClose(h);
     TinyOAL::Instance()->GetMp3()->fn_mpgDelete(h);
-    return std::pair<void*, uint32_t>((void*)0, 0);
+    return std::pair<void*, uint64_t>((void*)0, 0);
   };
 
   if(err != MPG123_OK)
@@ -204,26 +244,23 @@ std::pair<void*, uint32_t> AudioResourceMP3::ToWave(void* data, uint32_t datalen
 
   long freq;
   int channels, enc;
-  err = fn->fn_mpgGetFormat(h, &freq, &channels, &enc);
-  if(!err)
-    err = fn->fn_mpgFormatNone(h);
-  if(!err)
-    err = fn->fn_mpgFormat(h, freq, channels, enc);
-  if(err != 0)
+  if(_lockformat(h, &freq, &channels, &enc, TinyOAL::Instance()->GetFloatDecode()) != MPG123_OK)
     return fnabort(h, "Failed to get or set format");
 
   unsigned char bits  = (enc == MPG123_ENC_SIGNED_16) ? 16 : 32;
-  uint32_t total  = len * (bits >> 3) * channels;
+  uint64_t total  = (uint64_t)len * (bits >> 3) * channels;
+  if(total > UINT32_MAX) // _read() takes a 32-bit length
+    return fnabort(h, "Stream is too long to decode into memory");
   uint32_t header = TinyOAL::Instance()->GetWave()->WriteHeader(0, 0, 0, 0, 0);
-  char* buffer        = (char*)malloc(total + header);
+  char* buffer        = (char*)malloc((size_t)total + header);
   assert(buffer != 0);
   bool eof;
-  total = _read(h, buffer + header, total, eof);
+  total = _read(h, buffer + header, (uint32_t)total, eof);
   TinyOAL::Instance()->GetWave()->WriteHeader(buffer, total + header, channels, bits, freq);
 
   fn->fn_mpgClose(h);
   fn->fn_mpgDelete(h);
-  return std::pair<void*, uint32_t>(buffer, total + header);
+  return std::pair<void*, uint64_t>(buffer, total + header);
 }
 
 void AudioResourceMP3::cb_cleanup(void* dat)
@@ -237,10 +274,27 @@ off_t AudioResourceMP3::cb_datseek(void* stream, off_t off, int loc)
     return dat_tell_func(stream);
   return -1;
 }
-ssize_t AudioResourceMP3::cb_fileread(void* stream, void* dst, size_t n) { return fread(dst, 1, n, (FILE*)stream); }
+// Every handle reads the file through a cursor of its own, which mpg123 hands back to cb_filecleanup when it's closed
+int AudioResourceMP3::_openfile(mpg123_handle* h, FILE* file, uint64_t start, uint64_t datalength)
+{
+  auto fn          = TinyOAL::Instance()->GetMp3();
+  FileStream* data = TinyOAL::Instance()->AllocViaPool<FileStream>();
+  filestream_init(*data, file, start, datalength);
+  fn->fn_mpgReplaceReader(h, &cb_fileread, &cb_fileseek, &cb_filecleanup);
+  return fn->fn_mpgOpenHandle(h, data);
+}
+void AudioResourceMP3::cb_filecleanup(void* stream)
+{
+  filestream_close_func(stream);
+  TinyOAL::Instance()->DeallocViaPool<FileStream>(reinterpret_cast<FileStream*>(stream));
+}
+ssize_t AudioResourceMP3::cb_fileread(void* stream, void* dst, size_t n)
+{
+  return filestream_read_func(dst, 1, n, stream);
+}
 off_t AudioResourceMP3::cb_fileseek(void* stream, off_t off, int loc)
 {
-  if(!fseek((FILE*)stream, off, loc))
-    return ftell((FILE*)stream);
+  if(!filestream_seek_func(stream, off, loc))
+    return (off_t)filestream_tell_func(stream);
   return -1;
 }
\ No newline at end of file
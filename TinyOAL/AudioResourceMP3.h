@@ -14,7 +14,7 @@ namespace tinyoal {
   class AudioResourceMP3 : public AudioResource
   {
   public:
-    AudioResourceMP3(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    AudioResourceMP3(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     ~AudioResourceMP3();
     virtual void* OpenStream();             // This returns a pointer to the internal stream on success, or NULL on failure
     virtual void CloseStream(void* stream); // This closes an AUDIOSTREAM pointer
@@ -24,18 +24,30 @@ namespace tinyoal {
     virtual bool Skip(void* stream, uint64_t samples); // Sets a stream to given sample
     virtual uint64_t Tell(void* stream);               // Gets what sample a stream is currently on
 
-    static size_t Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    static size_t Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     static bool ScanHeader(const char* fileheader);
-    static std::pair<void*, uint32_t> ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags);
+    static std::pair<void*, uint64_t> ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags);
 
   protected:
     static void cb_cleanup(void* dat);
     static unsigned long _read(void* stream, char* buffer, uint32_t len, bool& eof);
+    static int _lockformat(mpg123_handle* h, long* freq, int* channels, int* enc, bool tofloat);
+    mpg123_handle* _openstream(long* freq, int* channels, int* enc, bool tofloat);
+    static int _openfile(mpg123_handle* h, FILE* file, uint64_t start, uint64_t datalength);
+
+    void _deletestream(mpg123_handle* h);
+
+    static const uint32_t POOLSIZE = 8;
+    mpg123_handle* _pool[POOLSIZE]; // Opened handles from closed streams that can be rewound and reused
+    uint32_t _pooled;
+    off_t* _index; // Frame index from the first scan of the file, given to every new handle
+    off_t _indexstep;
+    size_t _indexfill;
     static ssize_t cb_datread(void* stream, void* dst, size_t n);
     static off_t cb_datseek(void* stream, off_t off, int loc);
     static ssize_t cb_fileread(void* stream, void* dst, size_t n);
     static off_t cb_fileseek(void* stream, off_t off, int loc);
-    static off_t cb_fileseekoffset(void* stream, off_t off, int loc);
+    static void cb_filecleanup(void* stream);
   };
 }
 #endif
\ No newline at end of file
@@ -6,12 +6,16 @@
 #include "tinyoal/TinyOAL.h"
 #include "WaveFunctions.h"
 #include "Engine.h"
+#include "Kernels.h"
 
 using namespace tinyoal;
 
 // Constructor that takes a data pointer, a length of data, and flags.
-AudioResourceOGG::AudioResourceOGG(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
-  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_OGG, loop)
+AudioResourceOGG::AudioResourceOGG(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
+  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_OGG, loop),
+  _freelist(0),
+  _shuffle(),
+  _index(&_cbindex, this)
 {
   _setcallbacks(_callbacks, (_flags & TINYOAL_ISFILE) != 0);
   // Open an initial stream and read in static information from the file
@@ -26,11 +30,12 @@ AudioResourceOGG::AudioResourceOGG(void* data, uint32_t datalength, TINYOAL_FLAG
   {
     _freq       = psVorbisInfo->rate;
     _channels   = psVorbisInfo->channels;
-    _samplebits = 16;
-    _bufsize    = (_freq * _channels * 2) >>
-               2; // Sets buffer size to 250 ms, which is freq * 2 (bytes per sample) / 4 (quarter of a second)
-    _bufsize -= (_bufsize % (_channels * 2));
-    _format = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+    _samplebits = (TinyOAL::Instance()->GetFloatDecode() && ogg->fn_ov_read_float) ? 32 : 16;
+    _bufsize    = (_freq * _channels * (_samplebits >> 3)) >>
+               2; // Sets buffer size to 250 ms, which is freq * bytes per sample / 4 (quarter of a second)
+    _bufsize -= (_bufsize % (_channels * (_samplebits >> 3)));
+    _format  = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+    _shuffle = GetShuffle(_channels, _samplebits >> 3);
     _total  = ogg->fn_ov_pcm_total(&f->ogg, -1);
   }
 
@@ -44,10 +49,33 @@ AudioResourceOGG::AudioResourceOGG(void* data, uint32_t datalength, TINYOAL_FLAG
   CloseStream(f);
 }
 
-AudioResourceOGG::~AudioResourceOGG() { _destruct(); }
+AudioResourceOGG::~AudioResourceOGG()
+{
+  _index.Stop(); // The build reads _data, so it has to finish before anything is freed
+  _destruct();   // Closes every stream, so they all end up on the freelist
+  while(_freelist)
+  {
+    OggVorbis_FileEx* r = _freelist;
+    _freelist           = _freelist->next;
+    TinyOAL::Instance()->GetOgg()->fn_ov_clear(&r->ogg);
+    TinyOAL::Instance()->DeallocViaPool<OggVorbis_FileEx>(r);
+  }
+}
 
 void* AudioResourceOGG::OpenStream()
 {
+  // ov_open has to parse all three headers and find the end of the file, so we keep closed streams around instead and
+  // just seek them back to the start.
+  while(_freelist)
+  {
+    OggVorbis_FileEx* r = _freelist;
+    _freelist           = _freelist->next;
+    if(!TinyOAL::Instance()->GetOgg()->fn_ov_pcm_seek(&r->ogg, 0))
+      return r;
+    TinyOAL::Instance()->GetOgg()->fn_ov_clear(&r->ogg);
+    TinyOAL::Instance()->DeallocViaPool<OggVorbis_FileEx>(r);
+  }
+
   OggVorbis_FileEx* r = TinyOAL::Instance()->AllocViaPool<OggVorbis_FileEx>();
   if(_openstream(r))
     return r;
@@ -57,8 +85,8 @@ void* AudioResourceOGG::OpenStream()
 
 bool AudioResourceOGG::_openstream(OggVorbis_FileEx* r)
 {
-  if(_flags & TINYOAL_ISFILE)
-    fseek((FILE*)_data, 0, SEEK_SET); // If we're a file, reset the pointer
+  if(_flags & TINYOAL_ISFILE) // If we're a file, this stream gets its own cursor into it
+    filestream_init(r->file, (FILE*)_data, 0, _datalength);
   else
   { // Otherwise, set the data pointers in our Ex structure
     r->stream.data = r->stream.streampos = (const char*)_data;
@@ -66,11 +94,13 @@ bool AudioResourceOGG::_openstream(OggVorbis_FileEx* r)
   }
 
   OggFunctions* ogg = TinyOAL::Instance()->GetOgg();
+  void* source      = (_flags & TINYOAL_ISFILE) ? (void*)&r->file : &r->stream;
 
-  if(!ogg || !ogg->fn_ov_open_callbacks ||
-     ogg->fn_ov_open_callbacks((_flags & TINYOAL_ISFILE) ? _data : &r->stream, &r->ogg, 0, 0, _callbacks) != 0)
+  if(!ogg || !ogg->fn_ov_open_callbacks || ogg->fn_ov_open_callbacks(source, &r->ogg, 0, 0, _callbacks) != 0)
   {
     TINYOAL_LOG(1, "Failed to create file stream");
+    if(_flags & TINYOAL_ISFILE)
+      filestream_close_func(&r->file); // ov_open_callbacks doesn't close the source when it fails
     return false;
   }
   return true;
@@ -79,30 +109,68 @@ bool AudioResourceOGG::_openstream(OggVorbis_FileEx* r)
 void AudioResourceOGG::CloseStream(void* stream)
 {
   OggVorbis_FileEx* data = reinterpret_cast<OggVorbis_FileEx*>(stream);
-  TinyOAL::Instance()->GetOgg()->fn_ov_clear(&data->ogg);
-  TinyOAL::Instance()->DeallocViaPool<OggVorbis_FileEx>(data);
+  data->next             = _freelist;
+  _freelist              = data;
+}
+
+// Vorbis orders its channels differently from WAVEFORMATEXTENSIBLE once there are more than 2 of them (4 happens to
+// match). Output channel i is taken from Vorbis channel OGG_CHANNELMAP[channels - 3][i].
+static const uint8_t OGG_CHANNELMAP[6][8] = {
+  { 0, 2, 1 },                // FL FC FR                    -> FL FR FC
+  { 0, 1, 2, 3 },             // FL FR RL RR                 -> FL FR RL RR
+  { 0, 2, 1, 3, 4 },          // FL FC FR RL RR              -> FL FR FC RL RR
+  { 0, 2, 1, 5, 3, 4 },       // FL FC FR RL RR LFE          -> FL FR FC LFE RL RR
+  { 0, 2, 1, 6, 5, 3, 4 },    // FL FC FR SL SR RC LFE       -> FL FR FC LFE RC SL SR
+  { 0, 2, 1, 7, 5, 6, 3, 4 }, // FL FC FR SL SR RL RR LFE    -> FL FR FC LFE RL RR SL SR
+};
+
+FrameShuffle AudioResourceOGG::GetShuffle(uint32_t channels, uint32_t bytes)
+{
+  return FrameShuffle::Build((channels < 3 || channels > 8 || channels == 4) ? nullptr : OGG_CHANNELMAP[channels - 3],
+                             channels, bytes);
 }
 
 // This is the important function. Using the stream given to us, we know that it must be an OGG stream, and thus will
 // have the information we need contained in the pointer. We use this information to decode a chunk of the audio info
 // and put it inside the given decodebuffer (which is the same for all audio formats, since its decoded). It then
-// returns how many bytes were read.
+// returns how many bytes were read. If bytes is 4, the samples are decoded as floats.
 unsigned long AudioResourceOGG::_read(void* stream, char* buffer, uint32_t len, bool& eof, char bytes,
-                                      uint32_t channels)
+                                      uint32_t channels, const FrameShuffle& shuffle)
 {
   if(!stream)
     return 0;
+  OggFunctions* ogg = TinyOAL::Instance()->GetOgg();
   int current_section;
   long lDecodeSize = 1;
-  unsigned long ulSamples;
-  short* pSamples;
-  eof = false;
+  uint32_t frame   = bytes * channels;
+  eof              = false;
 
   unsigned long ulBytesDone = 0;
   while(lDecodeSize > 0)
   {
-    lDecodeSize = TinyOAL::Instance()->GetOgg()->fn_ov_read((OggVorbis_File*)stream, buffer + ulBytesDone,
-                                                            len - ulBytesDone, 0, bytes, 1, &current_section);
+    if(bytes == 4)
+    { // ov_read_float hands us the decoder's own planar float output, so all we have to do is interleave it
+      int samples = (len - ulBytesDone) / frame;
+      if(!samples)
+        break;
+      float** pcm;
+      lDecodeSize = ogg->fn_ov_read_float((OggVorbis_File*)stream, &pcm, samples, &current_section);
+      if(lDecodeSize > 0)
+      {
+        float* target = reinterpret_cast<float*>(buffer + ulBytesDone);
+        for(long i = 0; i < lDecodeSize; ++i)
+        {
+          for(uint32_t j = 0; j < channels; ++j)
+            target[j] = pcm[j][i];
+          target += channels;
+        }
+        lDecodeSize *= frame;
+      }
+    }
+    else
+      lDecodeSize =
+        ogg->fn_ov_read((OggVorbis_File*)stream, buffer + ulBytesDone, len - ulBytesDone, 0, bytes, 1, &current_section);
+
     if(lDecodeSize > 0)
     {
       ulBytesDone += lDecodeSize;
@@ -113,26 +181,14 @@ unsigned long AudioResourceOGG::_read(void* stream, char* buffer, uint32_t len,
       eof = true;
   }
 
-  // Mono, Stereo and 4-Channel files decode into the same channel order as WAVEFORMATEXTENSIBLE,
-  // however 6-Channels files need to be re-ordered
-  if(channels == 6)
-  {
-    pSamples = (short*)buffer;
-    for(ulSamples = 0; ulSamples < (len / bytes); ulSamples += 6)
-    {
-      // WAVEFORMATEXTENSIBLE Order : FL, FR, FC, LFE, RL, RR
-      // OggVorbis Order            : FL, FC, FR,  RL, RR, LFE
-      std::swap<short>(pSamples[ulSamples + 1], pSamples[ulSamples + 2]);
-      std::swap<short>(pSamples[ulSamples + 3], pSamples[ulSamples + 5]);
-      std::swap<short>(pSamples[ulSamples + 4], pSamples[ulSamples + 5]);
-    }
-  }
+  if(shuffle.size)
+    Kernels::Get().ShuffleFrames(reinterpret_cast<uint8_t*>(buffer), ulBytesDone / shuffle.size, shuffle);
 
   return ulBytesDone;
 }
 unsigned long AudioResourceOGG::Read(void* stream, char* buffer, uint32_t len, bool& eof)
 {
-  return _read(stream, buffer, len, eof, _samplebits >> 3, _channels);
+  return _read(stream, buffer, len, eof, _samplebits >> 3, _channels, _shuffle);
 }
 bool AudioResourceOGG::Reset(void* stream)
 {
@@ -149,8 +205,33 @@ bool AudioResourceOGG::Skip(void* stream, uint64_t samples)
 {
   if(!stream)
     return false;
+  OggFunctions* ogg  = TinyOAL::Instance()->GetOgg();
+  OggVorbis_File* vf = (OggVorbis_File*)stream;
 
-  if(!TinyOAL::Instance()->GetOgg()->fn_ov_pcm_seek((OggVorbis_File*)stream, (ogg_int64_t)samples))
+  if(samples && ogg->fn_ov_raw_seek && ogg->fn_ov_read_float)
+  {
+    _index.Request(); // Until the indexer gets to it, this seek and any after it use ov_pcm_seek
+    // Start from the last page that finishes before the target and decode forward to it, which is what ov_pcm_seek
+    // does once its bisection search finds that page.
+    const SeekIndex::Point* p = _index.Find(samples - 1);
+    if(p && !ogg->fn_ov_raw_seek(vf, (ogg_int64_t)p->offset))
+    {
+      ogg_int64_t pos = ogg->fn_ov_pcm_tell(vf);
+      while(pos >= 0 && (uint64_t)pos < samples)
+      {
+        float** pcm;
+        int section;
+        long n = ogg->fn_ov_read_float(vf, &pcm, (int)std::min<uint64_t>(samples - pos, 4096), &section);
+        if(n <= 0)
+          break;
+        pos += n;
+      }
+      if(pos == (ogg_int64_t)samples)
+        return true;
+    }
+  }
+
+  if(!ogg->fn_ov_pcm_seek(vf, (ogg_int64_t)samples))
     return true;
   else
     TINYOAL_LOG(2, "Seek failed to skip to %llu", samples);
@@ -166,39 +247,89 @@ uint64_t AudioResourceOGG::Tell(void* stream) // Gets what sample a stream is cu
     return 0;
   return TinyOAL::Instance()->GetOgg()->fn_ov_pcm_tell((OggVorbis_File*)stream);
 }
+void AudioResourceOGG::_cbindex(void* owner, std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel)
+{
+  ((AudioResourceOGG*)owner)->_buildindex(points, cancel);
+}
+// Runs on the indexer thread, so this only reads _data with file_pread or straight out of memory and never logs
+void AudioResourceOGG::_buildindex(std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel)
+{
+  FILE* file = (_flags & TINYOAL_ISFILE) ? (FILE*)_data : nullptr;
+  auto fetch = [&](uint8_t* dst, uint64_t at, size_t len) -> bool {
+    if(at + len > _datalength)
+      return false;
+    if(file)
+      return file_pread(file, dst, len, at) == len;
+    memcpy(dst, (const char*)_data + at, len);
+    return true;
+  };
+
+  // We only need the page headers, which lets us walk the whole stream without decoding anything. Each one is 27 bytes
+  // followed by a table of segment lengths that add up to the size of the page body.
+  uint8_t page[27 + 255];
+  uint64_t offset = 0;
+  uint32_t serial = 0;
+  while(!cancel.load(std::memory_order_relaxed) && fetch(page, offset, 27) && !memcmp(page, "OggS", 4) &&
+        fetch(page + 27, offset + 27, page[26]))
+  {
+    uint64_t granule = 0;
+    for(int i = 7; i >= 0; --i)
+      granule = (granule << 8) | page[6 + i];
+    uint32_t id = page[14] | (page[15] << 8) | (page[16] << 16) | ((uint32_t)page[17] << 24);
+    if(!offset)
+      serial = id;
+    else if(id != serial)
+    { // Chained or multiplexed streams have more than one timeline, so we leave those to ov_pcm_seek
+      points.clear();
+      break;
+    }
+
+    if((int64_t)granule > 0) // Skips the header pages and pages that don't finish a packet, which have no position
+      points.push_back({ granule, offset });
+
+    offset += 27 + page[26];
+    for(uint8_t i = 0; i < page[26]; ++i)
+      offset += page[27 + i];
+  }
+}
 void AudioResourceOGG::_setcallbacks(ov_callbacks& callbacks, bool isfile)
 {
   if(isfile)
   {
-    callbacks.read_func  = file_read_func;
-    callbacks.seek_func  = file_seek_func;
-    callbacks.close_func = file_close_func;
-    callbacks.tell_func  = file_tell_func;
+    callbacks.read_func  = filestream_read_func;
+    callbacks.seek_func  = filestream_seek_func;
+    callbacks.close_func = filestream_close_func;
+    callbacks.tell_func  = [](void* f) -> long { return (long)filestream_tell_func(f); }; // libvorbisfile tells in longs
   }
   else
   {
     callbacks.read_func  = dat_read_func;
     callbacks.seek_func  = dat_seek_func;
     callbacks.close_func = dat_close_func;
-    callbacks.tell_func  = dat_tell_func;
+    callbacks.tell_func  = [](void* d) -> long { return (long)dat_tell_func(d); };
   }
 }
 
-size_t AudioResourceOGG::Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop)
+size_t AudioResourceOGG::Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop)
 {
   if(p)
     new(p) AudioResourceOGG(data, datalength, flags, loop);
   return sizeof(AudioResourceOGG);
 }
-bool AudioResourceOGG::ScanHeader(const char* fileheader) { return !strncmp(fileheader, "OggS", 4); }
+bool AudioResourceOGG::ScanHeader(const char* fileheader)
+{
+  return !strncmp(fileheader, "OggS", 4) && strncmp(fileheader + 28, "OpusHead", 8) != 0; // Opus has its own codec
+}
 
-std::pair<void*, uint32_t> AudioResourceOGG::ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags)
+std::pair<void*, uint64_t> AudioResourceOGG::ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags)
 {
   ov_callbacks callbacks;
   _setcallbacks(callbacks, (flags & TINYOAL_ISFILE) != 0);
 
   OggVorbis_FileEx r;
-  if(!(flags & TINYOAL_ISFILE))
+  if(flags & TINYOAL_ISFILE) // Reads from wherever the FILE* was left
+    filestream_init(r.file, (FILE*)data, file_tell_func(data), datalength);
+  else
   {
     r.stream.data = r.stream.streampos = (const char*)data;
     r.stream.datalength                = datalength;
@@ -206,10 +337,12 @@ std::pair<void*, uint32_t> AudioResourceOGG::ToWave(void* data, uint32_t datalen
   OggFunctions* ogg = TinyOAL::Instance()->GetOgg();
 
   if(!ogg || !ogg->fn_ov_open_callbacks ||
-     ogg->fn_ov_open_callbacks((flags & TINYOAL_ISFILE) ? data : &r.stream, &r.ogg, 0, 0, callbacks) != 0)
+     ogg->fn_ov_open_callbacks((flags & TINYOAL_ISFILE) ? (void*)&r.file : &r.stream, &r.ogg, 0, 0, callbacks) != 0)
   {
     TINYOAL_LOG(1, "Failed to create file stream");
-    return std::pair<void*, uint32_t>((void*)0, 0);
+    if(flags & TINYOAL_ISFILE)
+      filestream_close_func(&r.file);
+    return std::pair<void*, uint64_t>((void*)0, 0);
   }
 
   // Get some information about the file (Channels, Format, and Frequency)
@@ -217,20 +350,27 @@ std::pair<void*, uint32_t> AudioResourceOGG::ToWave(void* data, uint32_t datalen
   if(!psVorbisInfo)
   {
     ogg->fn_ov_clear(&r.ogg);
-    return std::pair<void*, uint32_t>((void*)0, 0);
+    return std::pair<void*, uint64_t>((void*)0, 0);
   }
 
   uint64_t total      = ogg->fn_ov_pcm_total(&r.ogg, -1); // Get total number of samples
   long freq           = psVorbisInfo->rate;
   int channels        = psVorbisInfo->channels;
-  short samplebits    = 16;
+  short samplebits    = (TinyOAL::Instance()->GetFloatDecode() && ogg->fn_ov_read_float) ? 32 : 16;
   uint64_t totalbytes = total * channels * (samplebits >> 3);
+  if(totalbytes > UINT32_MAX) // _read() takes a 32-bit length
+  {
+    TINYOAL_LOG(1, "Stream is too long to decode into memory");
+    ogg->fn_ov_clear(&r.ogg);
+    return std::pair<void*, uint64_t>((void*)0, 0);
+  }
   uint32_t header = TinyOAL::Instance()->GetWave()->WriteHeader(0, 0, 0, 0, 0);
-  char* buffer        = (char*)malloc(totalbytes + header);
+  char* buffer        = (char*)malloc((size_t)totalbytes + header);
   assert(buffer != 0);
   bool eof;
-  totalbytes = _read(&r, buffer + header, totalbytes, eof, samplebits >> 3, channels);
+  totalbytes = _read(&r, buffer + header, (uint32_t)totalbytes, eof, samplebits >> 3, channels,
+                     GetShuffle(channels, samplebits >> 3));
   TinyOAL::Instance()->GetWave()->WriteHeader(buffer, totalbytes + header, channels, samplebits, freq);
   ogg->fn_ov_clear(&r.ogg);
-  return std::pair<void*, uint32_t>(buffer, totalbytes + header);
+  return std::pair<void*, uint64_t>(buffer, totalbytes + header);
 }
@@ -8,19 +8,23 @@
 
 #include "tinyoal/AudioResource.h"
 #include "OggFunctions.h"
+#include "Kernels.h"
+#include "SeekIndex.h"
 
 namespace tinyoal {
   struct OggVorbis_FileEx
   { // To make things simpler, we append data streaming information to the end of the ogg file.
     OggVorbis_File ogg;
     DatStream stream;
+    FileStream file;
+    OggVorbis_FileEx* next; // Links closed streams on the resource's freelist
   };
 
   // This is a resource class for OGG files, and handles all the IO operations from the given buffer
   class AudioResourceOGG : public AudioResource
   {
   public:
-    AudioResourceOGG(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    AudioResourceOGG(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     ~AudioResourceOGG();
     virtual void* OpenStream();             // This returns a pointer to the internal stream on success, or NULL on failure
     virtual void CloseStream(void* stream); // This closes an AUDIOSTREAM pointer
@@ -30,18 +34,25 @@ namespace tinyoal {
     virtual bool Skip(void* stream, uint64_t samples); // Sets a stream to given sample
     virtual uint64_t Tell(void* stream);               // Gets what sample a stream is currently on
 
-    static size_t Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    static size_t Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     static bool ScanHeader(const char* fileheader);
-    static std::pair<void*, uint32_t> ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags);
+    static std::pair<void*, uint64_t> ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags);
+    // Shuffle from the Vorbis channel order to WAVEFORMATEXTENSIBLE order, which Opus shares
+    static FrameShuffle GetShuffle(uint32_t channels, uint32_t bytes);
 
   protected:
     static unsigned long _read(
-      void* stream, char* buffer, uint32_t len, bool& eof, char bytes,
-      uint32_t channels); // Reads next chunk of data - buffer must be at least GetBufSize() long
+      void* stream, char* buffer, uint32_t len, bool& eof, char bytes, uint32_t channels,
+      const FrameShuffle& shuffle); // Reads next chunk of data - buffer must be at least GetBufSize() long
     bool _openstream(OggVorbis_FileEx* target);
     static void _setcallbacks(ov_callbacks& callbacks, bool isfile);
+    static void _cbindex(void* owner, std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel);
+    void _buildindex(std::vector<SeekIndex::Point>& points, const std::atomic<bool>& cancel);
 
     ov_callbacks _callbacks;
+    OggVorbis_FileEx* _freelist; // Closed streams that already have their headers parsed
+    FrameShuffle _shuffle; // Puts Vorbis channels in WAVEFORMATEXTENSIBLE order
+    SeekIndex _index;      // Last sample and byte offset of every page, built in the background after the first seek
   };
 }
 
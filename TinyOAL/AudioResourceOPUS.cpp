@@ -0,0 +1,220 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+
+#include "AudioResourceOPUS.h"
+#include "AudioResourceOGG.h"
+#include "tinyoal/TinyOAL.h"
+#include "WaveFunctions.h"
+#include "Engine.h"
+
+using namespace tinyoal;
+
+AudioResourceOPUS::AudioResourceOPUS(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
+  AudioResource(data, datalength, flags, TINYOAL_FILETYPE_OPUS, loop), _freelist(0), _shuffle()
+{
+  // Open an initial stream and read in static information from the file
+  OggOpusFileEx* f = (OggOpusFileEx*)OpenStream();
+  if(!f)
+    return;
+
+  OpusFunctions* opus = TinyOAL::Instance()->GetOpus();
+  _freq               = FREQUENCY;
+  _channels           = opus->fn_op_channel_count(f->op, -1);
+  _samplebits         = (TinyOAL::Instance()->GetFloatDecode() && opus->fn_op_read_float) ? 32 : 16;
+  _bufsize            = (_freq * _channels * (_samplebits >> 3)) >> 2; // 250 ms
+  _bufsize -= (_bufsize % (_channels * (_samplebits >> 3)));
+  _format  = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+  _shuffle = AudioResourceOGG::GetShuffle(_channels, _samplebits >> 3);
+  _total   = opus->fn_op_pcm_total(f->op, -1);
+
+  if(!_format)
+    TINYOAL_LOG(1, "Failed to find format information, or unsupported format");
+
+  ogg_int64_t fileloop = opus->GetLoopStart(f->op);
+  if(fileloop != -1LL)
+    _loop = fileloop; // Only overwrite our loop point with the file loop point if it actually had one.
+  CloseStream(f);
+}
+
+AudioResourceOPUS::~AudioResourceOPUS()
+{
+  _destruct(); // Closes every stream, so they all end up on the freelist
+  while(_freelist)
+  {
+    OggOpusFileEx* r = _freelist;
+    _freelist        = _freelist->next;
+    TinyOAL::Instance()->GetOpus()->fn_op_free(r->op);
+    TinyOAL::Instance()->DeallocViaPool<OggOpusFileEx>(r);
+  }
+}
+
+void* AudioResourceOPUS::OpenStream()
+{
+  while(_freelist) // Rewinding a closed stream is much cheaper than parsing the headers again
+  {
+    OggOpusFileEx* r = _freelist;
+    _freelist        = _freelist->next;
+    if(!TinyOAL::Instance()->GetOpus()->fn_op_pcm_seek(r->op, 0))
+      return r;
+    TinyOAL::Instance()->GetOpus()->fn_op_free(r->op);
+    TinyOAL::Instance()->DeallocViaPool<OggOpusFileEx>(r);
+  }
+
+  OggOpusFileEx* r = TinyOAL::Instance()->AllocViaPool<OggOpusFileEx>();
+  if((r->op = _open(_data, 0, _datalength, (_flags & TINYOAL_ISFILE) != 0, *r)) != nullptr)
+    return r;
+  TinyOAL::Instance()->DeallocViaPool<OggOpusFileEx>(r);
+  return 0;
+}
+
+// Files are read through a cursor that belongs to ex, starting at start, which op_free closes along with the decoder
+OggOpusFile* AudioResourceOPUS::_open(void* data, uint64_t start, uint64_t datalength, bool isfile, OggOpusFileEx& ex)
+{
+  static const OpusFileCallbacks DATCALLBACKS  = { &_cbdatread, &_cbdatseek, &_cbdattell, nullptr };
+  static const OpusFileCallbacks FILECALLBACKS = { &_cbfileread, &_cbfileseek, &_cbfiletell, &filestream_close_func };
+  OpusFunctions* opus                          = TinyOAL::Instance()->GetOpus();
+  if(!opus || !opus->fn_op_open_callbacks)
+    return nullptr;
+
+  if(isfile)
+    filestream_init(ex.file, (FILE*)data, start, datalength);
+  else
+  {
+    ex.stream.data = ex.stream.streampos = (const char*)data;
+    ex.stream.datalength                 = datalength;
+  }
+
+  int err         = 0;
+  OggOpusFile* op = opus->fn_op_open_callbacks(isfile ? (void*)&ex.file : &ex.stream,
+                                               isfile ? &FILECALLBACKS : &DATCALLBACKS, nullptr, 0, &err);
+  if(!op)
+  {
+    TINYOAL_LOG(1, "Failed to create file stream, op_open_callbacks returned %i", err);
+    if(isfile)
+      filestream_close_func(&ex.file); // op_open_callbacks leaves the stream open when it fails
+  }
+  return op;
+}
+
+void AudioResourceOPUS::CloseStream(void* stream)
+{
+  OggOpusFileEx* data = reinterpret_cast<OggOpusFileEx*>(stream);
+  data->next          = _freelist;
+  _freelist           = data;
+}
+
+// Unlike ov_read, op_read takes and returns the number of samples instead of bytes, and it always hands back interleaved
+// samples, so it can decode straight into the buffer in both formats.
+unsigned long AudioResourceOPUS::_read(OggOpusFile* op, char* buffer, uint32_t len, bool& eof, char bytes,
+                                       uint32_t channels, const FrameShuffle& shuffle)
+{
+  OpusFunctions* opus = TinyOAL::Instance()->GetOpus();
+  uint32_t frame      = bytes * channels;
+  unsigned long done  = 0;
+  eof                 = false;
+
+  while(len - done >= frame)
+  {
+    int samples = (int)((len - done) / bytes);
+    int n       = (bytes == 4) ? opus->fn_op_read_float(op, reinterpret_cast<float*>(buffer + done), samples, 0) :
+                                 opus->fn_op_read(op, reinterpret_cast<opus_int16*>(buffer + done), samples, 0);
+    if(n == OP_HOLE)
+      continue; // A gap in the data, opusfile already skipped past it
+    if(n <= 0)
+    {
+      eof = true;
+      break;
+    }
+    done += n * frame;
+  }
+
+  if(shuffle.size)
+    Kernels::Get().ShuffleFrames(reinterpret_cast<uint8_t*>(buffer), done / shuffle.size, shuffle);
+  return done;
+}
+unsigned long AudioResourceOPUS::Read(void* stream, char* buffer, uint32_t len, bool& eof)
+{
+  if(!stream)
+    return 0;
+  return _read(((OggOpusFileEx*)stream)->op, buffer, len, eof, _samplebits >> 3, _channels, _shuffle);
+}
+bool AudioResourceOPUS::Reset(void* stream) { return Skip(stream, 0); }
+bool AudioResourceOPUS::Skip(void* stream, uint64_t samples)
+{
+  if(!stream)
+    return false;
+  // op_pcm_seek is sample accurate, it decodes forward from the nearest page and throws away the extra samples
+  if(!TinyOAL::Instance()->GetOpus()->fn_op_pcm_seek(((OggOpusFileEx*)stream)->op, (ogg_int64_t)samples))
+    return true;
+  TINYOAL_LOG(2, "Seek failed to skip to %llu", samples);
+  return false;
+}
+uint64_t AudioResourceOPUS::Tell(void* stream)
+{
+  if(!stream)
+    return 0;
+  return TinyOAL::Instance()->GetOpus()->fn_op_pcm_tell(((OggOpusFileEx*)stream)->op);
+}
+
+int AudioResourceOPUS::_cbdatread(void* stream, unsigned char* ptr, int nbytes)
+{
+  return (int)dat_read_func(ptr, 1, nbytes, stream);
+}
+int AudioResourceOPUS::_cbdatseek(void* stream, opus_int64 offset, int whence)
+{
+  return dat_seek_func(stream, offset, whence);
+}
+opus_int64 AudioResourceOPUS::_cbdattell(void* stream) { return dat_tell_func(stream); }
+int AudioResourceOPUS::_cbfileread(void* stream, unsigned char* ptr, int nbytes)
+{
+  return (int)filestream_read_func(ptr, 1, nbytes, stream);
+}
+int AudioResourceOPUS::_cbfileseek(void* stream, opus_int64 offset, int whence)
+{
+  return filestream_seek_func(stream, offset, whence);
+}
+opus_int64 AudioResourceOPUS::_cbfiletell(void* stream) { return filestream_tell_func(stream); }
+
+size_t AudioResourceOPUS::Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop)
+{
+  if(p)
+    new(p) AudioResourceOPUS(data, datalength, flags, loop);
+  return sizeof(AudioResourceOPUS);
+}
+// Opus uses the same Ogg container as Vorbis, so we have to look at the start of the first packet, which begins right
+// after the 27 byte page header and its single byte segment table.
+bool AudioResourceOPUS::ScanHeader(const char* fileheader)
+{
+  return !strncmp(fileheader, "OggS", 4) && !strncmp(fileheader + 28, "OpusHead", 8);
+}
+
+std::pair<void*, uint64_t> AudioResourceOPUS::ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags)
+{
+  OggOpusFileEx ex; // Files are decoded from wherever the FILE* was left
+  bool isfile     = (flags & TINYOAL_ISFILE) != 0;
+  OggOpusFile* op = _open(data, isfile ? file_tell_func(data) : 0, datalength, isfile, ex);
+  if(!op)
+    return std::pair<void*, uint64_t>((void*)0, 0);
+
+  OpusFunctions* opus = TinyOAL::Instance()->GetOpus();
+  uint64_t total      = opus->fn_op_pcm_total(op, -1);
+  int channels        = opus->fn_op_channel_count(op, -1);
+  short samplebits    = (TinyOAL::Instance()->GetFloatDecode() && opus->fn_op_read_float) ? 32 : 16;
+  uint64_t totalbytes = total * channels * (samplebits >> 3);
+  if(totalbytes > UINT32_MAX) // _read() takes a 32-bit length
+  {
+    TINYOAL_LOG(1, "Stream is too long to decode into memory");
+    opus->fn_op_free(op);
+    return std::pair<void*, uint64_t>((void*)0, 0);
+  }
+  uint32_t header     = TinyOAL::Instance()->GetWave()->WriteHeader(0, 0, 0, 0, 0);
+  char* buffer        = (char*)malloc((size_t)totalbytes + header);
+  assert(buffer != 0);
+  bool eof;
+  totalbytes = _read(op, buffer + header, (uint32_t)totalbytes, eof, samplebits >> 3, channels,
+                     AudioResourceOGG::GetShuffle(channels, samplebits >> 3));
+  TinyOAL::Instance()->GetWave()->WriteHeader(buffer, totalbytes + header, channels, samplebits, FREQUENCY);
+  opus->fn_op_free(op);
+  return std::pair<void*, uint64_t>(buffer, totalbytes + header);
+}
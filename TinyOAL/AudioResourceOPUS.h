@@ -0,0 +1,58 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+// Notice: This header file does not need to be included in binary distributions of the library
+
+#ifndef TOAL__AUDIO_RESOURCE_OPUS_H
+#define TOAL__AUDIO_RESOURCE_OPUS_H
+
+#include "tinyoal/AudioResource.h"
+#include "OpusFunctions.h"
+#include "Kernels.h"
+
+namespace tinyoal {
+  struct OggOpusFileEx
+  { // opusfile allocates the decoder itself, so all we keep here is the handle and our data stream
+    OggOpusFile* op;
+    DatStream stream;
+    FileStream file;
+    OggOpusFileEx* next; // Links closed streams on the resource's freelist
+  };
+
+  // This is a resource class for Ogg Opus files, which always decode at 48 kHz
+  class AudioResourceOPUS : public AudioResource
+  {
+  public:
+    AudioResourceOPUS(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    ~AudioResourceOPUS();
+    virtual void* OpenStream();             // This returns a pointer to the internal stream on success, or NULL on failure
+    virtual void CloseStream(void* stream); // This closes an AUDIOSTREAM pointer
+    virtual unsigned long Read(void* stream, char* buffer, uint32_t len,
+                               bool& eof); // Reads next chunk of data - buffer must be at least GetBufSize() long
+    virtual bool Reset(void* stream);      // This resets a stream to the beginning
+    virtual bool Skip(void* stream, uint64_t samples); // Sets a stream to given sample
+    virtual uint64_t Tell(void* stream);               // Gets what sample a stream is currently on
+
+    static size_t Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    static bool ScanHeader(const char* fileheader);
+    static std::pair<void*, uint64_t> ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags);
+
+    static const uint32_t FREQUENCY = 48000;
+
+  protected:
+    static unsigned long _read(OggOpusFile* op, char* buffer, uint32_t len, bool& eof, char bytes, uint32_t channels,
+                               const FrameShuffle& shuffle);
+    static OggOpusFile* _open(void* data, uint64_t start, uint64_t datalength, bool isfile, OggOpusFileEx& ex);
+    static int _cbdatread(void* stream, unsigned char* ptr, int nbytes);
+    static int _cbdatseek(void* stream, opus_int64 offset, int whence);
+    static opus_int64 _cbdattell(void* stream);
+    static int _cbfileread(void* stream, unsigned char* ptr, int nbytes);
+    static int _cbfileseek(void* stream, opus_int64 offset, int whence);
+    static opus_int64 _cbfiletell(void* stream);
+
+    OggOpusFileEx* _freelist; // Closed streams that already have their headers parsed
+    FrameShuffle _shuffle;    // Opus uses the Vorbis channel order
+  };
+}
+
+#endif
@@ -8,7 +8,7 @@
 
 using namespace tinyoal;
 
-AudioResourceWAV::AudioResourceWAV(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
+AudioResourceWAV::AudioResourceWAV(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop) :
   AudioResource(data, datalength, flags, TINYOAL_FILETYPE_WAV, loop)
 {
   wav_callbacks callbacks;
@@ -35,6 +35,13 @@ AudioResourceWAV::AudioResourceWAV(void* data, uint32_t datalength, TINYOAL_FLAG
 
   TinyOAL::Instance()->GetWave()->Seek(_sentinel, 0);
 
+  // WASSource only builds integer PCM formats, so every engine but OpenAL gets 24-bit and 32-bit integer samples as
+  // integers. Otherwise the floats Read() hands out by default would be played as if they were integers.
+  if(TinyOAL::Instance()->GetEngine()->GetType() != ENGINE_OPENAL)
+    _sentinel.decode = WaveFunctions::WD_INT32;
+  else if(_flags & TINYOAL_INT32)
+    TINYOAL_LOG(2, "OpenAL can't play 32-bit integer samples, ignoring TINYOAL_INT32");
+
   _channels   = _sentinel.wfEXT.Format.nChannels;
   _freq       = _sentinel.wfEXT.Format.nSamplesPerSec;
   _samplebits = _sentinel.wfEXT.Format.wBitsPerSample;
@@ -59,6 +66,31 @@ AudioResourceWAV::AudioResourceWAV(void* data, uint32_t datalength, TINYOAL_FLAG
              (_samplebits *
               _channels); // This is a re-arranged version of size/(bits>>3)*_channels to prevent divide-by-zero errors
 
+  if(_sentinel.wfEXT.Format.wFormatTag == WAVE_FORMAT_IMA_ADPCM && _channels != 0)
+  {
+    _total = TinyOAL::Instance()->GetWave()->GetSamples(_sentinel);
+    if(!_format || TinyOAL::Instance()->GetEngine()->GetType() != ENGINE_OPENAL ||
+       TinyOAL::Instance()->GetWave()->HasPadding(_sentinel))
+    { // Only OpenAL with AL_LOKI_IMA_ADPCM_format can play ADPCM, so everyone else gets it decoded to 16-bit samples. So
+      // does a wave with padding at the end, because OpenAL would play all of the last block.
+      _sentinel.decode = WaveFunctions::WD_IMAADPCM;
+      _samplebits      = 16;
+      _format          = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+      _bufsize         = (_freq * _channels * 2) >> 2; // Queue 250ms of decoded audio data
+      _bufsize -= (_bufsize % (_channels * 2));
+    }
+  }
+
+  uint16_t tag = _sentinel.wfEXT.Format.wFormatTag;
+  if((tag == WAVE_FORMAT_MULAW || tag == WAVE_FORMAT_ALAW) &&
+     (!_format || TinyOAL::Instance()->GetEngine()->GetType() != ENGINE_OPENAL))
+  { // Without AL_EXT_MULAW or AL_EXT_ALAW we expand G.711 to 16-bit samples ourselves
+    _sentinel.decode = (tag == WAVE_FORMAT_MULAW) ? WaveFunctions::WD_MULAW : WaveFunctions::WD_ALAW;
+    _samplebits      = 16;
+    _format          = TinyOAL::Instance()->GetEngine()->GetFormat(_channels, _samplebits, false);
+    _bufsize <<= 1; // Still a multiple of the frame size, which doubled too
+  }
+
   if(!_format)
   {
     TINYOAL_LOG(1, "Failed to find format information, or unsupported format");
@@ -70,11 +102,16 @@ void* AudioResourceWAV::OpenStream()
 {
   if(!_sentinel.source)
     return 0; // Indicates a failure on file load
-  if(_flags & TINYOAL_ISFILE)
-    TinyOAL::Instance()->GetWave()->Seek(_sentinel, 0);
   WAVEFILEINFO* r = TinyOAL::Instance()->AllocViaPool<WAVEFILEINFO>();
   memcpy(r, &_sentinel, sizeof(WAVEFILEINFO));
-  r->source = (_flags & TINYOAL_ISFILE) ? _data : &r->stream;
+  r->source = &r->stream;
+  if(_flags & TINYOAL_ISFILE) // The sentinel reads the FILE* directly, but every stream gets a cursor of its own
+  {
+    r->callbacks = { filestream_read_func, filestream_seek_func, filestream_close_func, filestream_tell_func };
+    r->source    = &r->file;
+    filestream_init(r->file, (FILE*)_data, 0, _datalength);
+    TinyOAL::Instance()->GetWave()->Seek(*r, 0);
+  }
   return r;
 }
 
@@ -100,19 +137,21 @@ bool AudioResourceWAV::Reset(void* stream)
 
 bool AudioResourceWAV::Skip(void* stream, uint64_t samples)
 {
-  WAVEFILEINFO* r     = (WAVEFILEINFO*)stream;
-  uint16_t bits = r->wfEXT.Format.wBitsPerSample;
-  return !TinyOAL::Instance()->GetWave()->Seek(*r, samples * (bits >> 3) * _channels);
+  WAVEFILEINFO* r = (WAVEFILEINFO*)stream;
+  return !TinyOAL::Instance()->GetWave()->SeekSample(*r, samples);
 }
 uint64_t AudioResourceWAV::Tell(void* stream)
 {
-  WAVEFILEINFO* r     = (WAVEFILEINFO*)stream;
-  uint16_t bits = r->wfEXT.Format.wBitsPerSample;
-  uint64_t pos        = (bits >> 3) * _channels;
-  return !pos ? 0 : TinyOAL::Instance()->GetWave()->Tell(*r) / pos;
+  WAVEFILEINFO* r = (WAVEFILEINFO*)stream;
+  return TinyOAL::Instance()->GetWave()->TellSample(*r);
+}
+const char* AudioResourceWAV::Peek(void* stream, uint32_t len)
+{
+  WAVEFILEINFO* r = (WAVEFILEINFO*)stream;
+  return TinyOAL::Instance()->GetWave()->Peek(*r, len);
 }
 
-size_t AudioResourceWAV::Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop)
+size_t AudioResourceWAV::Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop)
 {
   if(p)
     new(p) AudioResourceWAV(data, datalength, flags, loop);
@@ -120,14 +159,17 @@ size_t AudioResourceWAV::Construct(void* p, void* data, uint32_t datalength, TIN
 }
 bool AudioResourceWAV::ScanHeader(const char* fileheader)
 {
-  return !strncmp(fileheader, "RIFF", 4) || !strncmp(fileheader, "RIFX", 4);
+  static const char W64[16] = { 'r', 'i', 'f', 'f', '\x2E', '\x91', '\xCF', '\x11',
+                                '\xA5', '\xD6', '\x28', '\xDB', '\x04', '\xC1', '\x00', '\x00' };
+  return !strncmp(fileheader, "RIFF", 4) || !strncmp(fileheader, "RIFX", 4) || !strncmp(fileheader, "RF64", 4) ||
+         !strncmp(fileheader, "BW64", 4) || !memcmp(fileheader, W64, sizeof(W64));
 }
-std::pair<void*, uint32_t> AudioResourceWAV::ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags)
+std::pair<void*, uint64_t> AudioResourceWAV::ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags)
 {
-  std::pair<void*, uint32_t> d = { malloc(datalength), datalength };
+  std::pair<void*, uint64_t> d = { malloc((size_t)datalength), datalength };
   if(flags & TINYOAL_ISFILE)
-    fread(d.first, 1, datalength, (FILE*)data);
+    fread(d.first, 1, (size_t)datalength, (FILE*)data);
   else
-    memcpy(d.first, data, datalength);
+    memcpy(d.first, data, (size_t)datalength);
   return d;
 }
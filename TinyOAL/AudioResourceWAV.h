@@ -14,7 +14,7 @@ namespace tinyoal {
   class AudioResourceWAV : public AudioResource
   {
   public:
-    AudioResourceWAV(void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    AudioResourceWAV(void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     ~AudioResourceWAV();
     virtual void* OpenStream();             // This returns a pointer to the internal stream on success, or NULL on failure
     virtual void CloseStream(void* stream); // This closes an AUDIOSTREAM pointer
@@ -23,10 +23,11 @@ namespace tinyoal {
     virtual bool Reset(void* stream);      // This resets a stream to the beginning
     virtual bool Skip(void* stream, uint64_t samples); // Sets a stream to given sample
     virtual uint64_t Tell(void* stream);               // Gets what sample a stream is currently on
+    virtual const char* Peek(void* stream, uint32_t len); // Points into our own data for in-memory PCM
 
-    static size_t Construct(void* p, void* data, uint32_t datalength, TINYOAL_FLAG flags, uint64_t loop);
+    static size_t Construct(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     static bool ScanHeader(const char* fileheader);
-    static std::pair<void*, uint32_t> ToWave(void* data, uint32_t datalength, TINYOAL_FLAG flags);
+    static std::pair<void*, uint64_t> ToWave(void* data, uint64_t datalength, TINYOAL_FLAG flags);
 
   protected:
     WAVEFILEINFO _sentinel; // stored wave file information state at the beginning of the file
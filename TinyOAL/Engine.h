@@ -15,6 +15,9 @@ namespace tinyoal {
   {
   public:
     using LoadBuffer = unsigned long (*)(unsigned long, char*, void*);
+    // Returns a pointer to exactly bufsize bytes that are already sitting in memory, or NULL if they have to be copied
+    // out with LoadBuffer instead. Only worth it for engines that would copy the samples again anyway.
+    using PeekBuffer = const char* (*)(unsigned long, void*);
 
     virtual ~Source() {}
     virtual bool Update(void* context, bool isPlaying)            = 0;
@@ -38,10 +41,12 @@ namespace tinyoal {
     virtual bool SetDevice(const char* device)                                                          = 0;
     virtual size_t GetDefaultDevice(char* out, size_t len)                                              = 0;
     virtual ENGINE_TYPE GetType()                                                                       = 0;
-    virtual Source* GenSource(Source::LoadBuffer loadBuffer, size_t bufsize, int format, uint32_t freq) = 0;
+    virtual Source* GenSource(Source::LoadBuffer loadBuffer, Source::PeekBuffer peekBuffer, size_t bufsize, int format,
+                              uint32_t freq)                                                            = 0;
     virtual void DestroySource(Source* source)                                                          = 0;
     virtual uint32_t GetFormat(uint16_t channels, uint16_t bits, bool rear)                             = 0;
     virtual uint32_t GetWaveFormat(WaveFileInfo& wave)                                                  = 0;
+    virtual uint32_t GetFrequency()                                                                     = 0;
   };
 }
 
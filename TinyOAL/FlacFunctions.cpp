@@ -5,14 +5,21 @@
 #include "FlacFunctions.h"
 #include "tinyoal/TinyOAL.h"
 
-#ifdef BUN_PLATFORM_WIN32
-  #include "win32_includes.h"
-
-  #define FLAC_MODULE     "libflac.dll"
-  #define FLAC_MODULE_ALT "flac.dll"
+#ifdef TINYOAL_STATIC_CODECS
+  #define FLAC_MODULE      ""
+  #define LOADDYNLIB(s)    (void*)(~0)
+  #define GETDYNFUNC(p, s) (&s)
+  #define FREEDYNLIB(p)    ((void)0)
 #else
-  #include <dlfcn.h>
-  #define FLAC_MODULE "libFLAC.so.8"
+  #ifdef BUN_PLATFORM_WIN32
+    #include "win32_includes.h"
+
+    #define FLAC_MODULE     "libflac.dll"
+    #define FLAC_MODULE_ALT "flac.dll"
+  #else
+    #include <dlfcn.h>
+    #define FLAC_MODULE "libFLAC.so.8"
+  #endif
 #endif
 
 #define DYNFUNC(v, t, n)          \
@@ -0,0 +1,818 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+
+#include "Kernels.h"
+#include <string.h>
+#include <math.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+  #define TOAL_TARGET_SSSE3
+  #define TOAL_TARGET_AVX2
+#else
+  #define TOAL_TARGET_SSSE3 __attribute__((target("ssse3")))
+  #define TOAL_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+using namespace tinyoal;
+
+namespace {
+  const int32_t IMA_STEPS[89] = { 7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,
+                                  25,    28,    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,
+                                  88,    97,    107,   118,   130,   143,   157,   173,   190,   209,   230,   253,   279,
+                                  307,   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,   876,   963,
+                                  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,  3327,
+                                  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487,
+                                  12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767 };
+  const int8_t IMA_INDICES[8]   = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+  // G.711 expansion tables. The extra entry lets the AVX2 gather read 32 bits at the last index without running off
+  // the end.
+  struct G711Table
+  {
+    int16_t v[257];
+  };
+  constexpr G711Table buildmulaw()
+  {
+    G711Table t = {};
+    for(int i = 0; i < 256; ++i)
+    {
+      int u  = ~i & 0xFF;
+      int x  = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+      t.v[i] = (int16_t)((u & 0x80) ? (0x84 - x) : (x - 0x84));
+    }
+    return t;
+  }
+  constexpr G711Table buildalaw()
+  {
+    G711Table t = {};
+    for(int i = 0; i < 256; ++i)
+    {
+      int a   = i ^ 0x55;
+      int seg = (a & 0x70) >> 4;
+      int x   = ((a & 0x0F) << 4) + ((seg > 0) ? 0x108 : 8);
+      if(seg > 1)
+        x <<= seg - 1;
+      t.v[i] = (int16_t)((a & 0x80) ? x : -x);
+    }
+    return t;
+  }
+  constexpr G711Table MULAW_TABLE = buildmulaw();
+  constexpr G711Table ALAW_TABLE  = buildalaw();
+
+  // Scalar versions, used on their own when nothing better is available and to finish off the tails of the SIMD loops
+  void s16mono_scalar(int16_t* dst, const int32_t* src, size_t num)
+  {
+    for(size_t i = 0; i < num; ++i)
+      dst[i] = (int16_t)src[i];
+  }
+  void s16stereo_scalar(int16_t* dst, const int32_t* left, const int32_t* right, size_t num)
+  {
+    for(size_t i = 0; i < num; ++i)
+    {
+      dst[i * 2]     = (int16_t)left[i];
+      dst[i * 2 + 1] = (int16_t)right[i];
+    }
+  }
+  void floatmono_scalar(float* dst, const int32_t* src, size_t num, float scale)
+  {
+    for(size_t i = 0; i < num; ++i)
+      dst[i] = (float)src[i] * scale;
+  }
+  void floatstereo_scalar(float* dst, const int32_t* left, const int32_t* right, size_t num, float scale)
+  {
+    for(size_t i = 0; i < num; ++i)
+    {
+      dst[i * 2]     = (float)left[i] * scale;
+      dst[i * 2 + 1] = (float)right[i] * scale;
+    }
+  }
+  inline int32_t s24read(const uint8_t* src)
+  { // Put the 24 bits in the top of the integer so the sign comes along for free
+    return (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24));
+  }
+  void s24tos32_scalar(int32_t* dst, const uint8_t* src, size_t num)
+  {
+    for(size_t i = num; i-- > 0;) // We go backwards so we don't trip over ourselves
+      dst[i] = s24read(src + i * 3);
+  }
+  void s24tofloat_scalar(float* dst, const uint8_t* src, size_t num)
+  {
+    for(size_t i = num; i-- > 0;)
+      dst[i] = (float)s24read(src + i * 3) * (1.0f / 2147483648.0f);
+  }
+  void s32tofloat_scalar(float* dst, const int32_t* src, size_t num)
+  {
+    for(size_t i = 0; i < num; ++i)
+      dst[i] = (float)src[i] * (1.0f / 2147483648.0f);
+  }
+
+  inline void g711_scalar(int16_t* dst, const uint8_t* src, size_t num, const G711Table& table)
+  {
+    for(size_t i = num; i-- > 0;) // Backwards, because every sample doubles in size
+      dst[i] = table.v[src[i]];
+  }
+  void mulaw_scalar(int16_t* dst, const uint8_t* src, size_t num) { g711_scalar(dst, src, num, MULAW_TABLE); }
+  void alaw_scalar(int16_t* dst, const uint8_t* src, size_t num) { g711_scalar(dst, src, num, ALAW_TABLE); }
+
+  void shuffleframes_scalar(uint8_t* samples, size_t frames, const FrameShuffle& shuffle)
+  {
+    uint8_t frame[32];
+    for(size_t i = 0; i < frames; ++i, samples += shuffle.size)
+    {
+      memcpy(frame, samples, shuffle.size);
+      for(uint32_t j = 0; j < shuffle.size; ++j)
+        samples[j] = frame[shuffle.src[j]];
+    }
+  }
+
+  inline int16_t imadecode(uint8_t nibble, int32_t& predictor, int32_t& index)
+  {
+    int32_t step = IMA_STEPS[index];
+    int32_t diff = step >> 3;
+    if(nibble & 1)
+      diff += step >> 2;
+    if(nibble & 2)
+      diff += step >> 1;
+    if(nibble & 4)
+      diff += step;
+    predictor += (nibble & 8) ? -diff : diff;
+    predictor = (predictor < -32768) ? -32768 : (predictor > 32767) ? 32767 : predictor;
+    index += IMA_INDICES[nibble & 7];
+    index = (index < 0) ? 0 : (index > 88) ? 88 : index;
+    return (int16_t)predictor;
+  }
+  void imaadpcm_scalar(int16_t* dst, const uint8_t* src, size_t groups, uint32_t channels)
+  {
+    for(uint32_t c = 0; c < channels; ++c)
+    {
+      const uint8_t* header = src + c * 4;
+      int32_t predictor     = (int16_t)(header[0] | (header[1] << 8));
+      int32_t index         = (header[2] > 88) ? 88 : header[2];
+      int16_t* out          = dst + c;
+      const uint8_t* data   = src + channels * 4 + c * 4;
+      *out                  = (int16_t)predictor;
+      out += channels;
+      for(size_t g = 0; g < groups; ++g, data += channels * 4)
+      {
+        for(uint32_t b = 0; b < 4; ++b) // Low nibble first
+        {
+          *out = imadecode(data[b] & 0xF, predictor, index);
+          out += channels;
+          *out = imadecode(data[b] >> 4, predictor, index);
+          out += channels;
+        }
+      }
+    }
+  }
+  void imaadpcmencode_scalar(uint8_t* dst, const int16_t* src, size_t groups, uint32_t channels, uint8_t* indices)
+  {
+    for(uint32_t c = 0; c < channels; ++c)
+    {
+      int32_t predictor = src[c];
+      int32_t index     = (indices[c] > 88) ? 88 : indices[c];
+      uint8_t* header   = dst + c * 4;
+      header[0]         = (uint8_t)(predictor & 0xFF);
+      header[1]         = (uint8_t)((predictor >> 8) & 0xFF);
+      header[2]         = (uint8_t)index;
+      header[3]         = 0;
+
+      const int16_t* in = src + channels + c;
+      uint8_t* data     = dst + channels * 4 + c * 4;
+      for(size_t g = 0; g < groups; ++g, data += channels * 4)
+      {
+        for(uint32_t k = 0; k < 8; ++k, in += channels)
+        {
+          int32_t diff   = *in - predictor;
+          int32_t step   = IMA_STEPS[index];
+          uint8_t nibble = 0;
+          if(diff < 0)
+          {
+            nibble = 8;
+            diff   = -diff;
+          }
+          for(uint8_t bit = 4; bit > 0; bit >>= 1, step >>= 1)
+          {
+            if(diff >= step)
+            {
+              nibble |= bit;
+              diff -= step;
+            }
+          }
+          imadecode(nibble, predictor, index); // Track exactly what the decoder will reconstruct
+          if(k & 1)
+            data[k >> 1] |= (nibble << 4);
+          else
+            data[k >> 1] = nibble;
+        }
+      }
+      indices[c] = (uint8_t)index;
+    }
+  }
+
+  void downmixs16_scalar(int16_t* dst, const int16_t* src, size_t frames, uint32_t channels)
+  {
+    for(size_t i = 0; i < frames; ++i, src += channels)
+    {
+      int32_t sum = 0;
+      for(uint32_t c = 0; c < channels; ++c)
+        sum += src[c];
+      // Round toward negative infinity like the arithmetic shift in the SIMD versions
+      dst[i] = (int16_t)((sum >= 0) ? sum / (int32_t)channels : -((-sum + (int32_t)channels - 1) / (int32_t)channels));
+    }
+  }
+  void downmixfloat_scalar(float* dst, const float* src, size_t frames, uint32_t channels)
+  {
+    float scale = 1.0f / channels;
+    for(size_t i = 0; i < frames; ++i, src += channels)
+    {
+      float sum = 0.0f;
+      for(uint32_t c = 0; c < channels; ++c)
+        sum += src[c];
+      dst[i] = sum * scale;
+    }
+  }
+
+  // Tracks which input sample and which filter phase each output sample of the resampling kernels lands on
+  struct ResampleCursor
+  {
+    ResampleCursor(const PolyphaseFilter& filter, uint64_t start) :
+      f(filter),
+      idx((size_t)((start * filter.in) / filter.out)),
+      rem((uint32_t)((start * filter.in) % filter.out)),
+      whole(filter.in / filter.out),
+      frac(filter.in % filter.out)
+    {}
+    inline const float* Taps() const { return f.bank.get() + (size_t)f.Phase(rem) * f.taps; }
+    inline void Next()
+    {
+      idx += whole;
+      if((rem += frac) >= f.out)
+      {
+        rem -= f.out;
+        ++idx;
+      }
+    }
+
+    const PolyphaseFilter& f;
+    size_t idx;
+    uint32_t rem;
+    uint32_t whole;
+    uint32_t frac;
+  };
+
+  // SSE2 is already required by the rest of the library, so these are the baseline.
+  void s16mono_sse2(int16_t* dst, const int32_t* src, size_t num)
+  {
+    size_t i = 0;
+    for(; i + 8 <= num; i += 8)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(a, b));
+    }
+    s16mono_scalar(dst + i, src + i, num - i);
+  }
+  void s16stereo_sse2(int16_t* dst, const int32_t* left, const int32_t* right, size_t num)
+  {
+    size_t i = 0;
+    for(; i + 4 <= num; i += 4)
+    {
+      __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+      // L0 R0 L1 R1 | L2 R2 L3 R3, then narrow both halves into one register
+      _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+    }
+    s16stereo_scalar(dst + i * 2, left + i, right + i, num - i);
+  }
+  void floatmono_sse2(float* dst, const int32_t* src, size_t num, float scale)
+  {
+    __m128 s = _mm_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 4 <= num; i += 4)
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + i))), s));
+    floatmono_scalar(dst + i, src + i, num - i, scale);
+  }
+  void floatstereo_sse2(float* dst, const int32_t* left, const int32_t* right, size_t num, float scale)
+  {
+    __m128 s = _mm_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 4 <= num; i += 4)
+    {
+      __m128 l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(left + i))), s);
+      __m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(right + i))), s);
+      _mm_storeu_ps(dst + i * 2, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+    floatstereo_scalar(dst + i * 2, left + i, right + i, num - i, scale);
+  }
+  void s32tofloat_sse2(float* dst, const int32_t* src, size_t num)
+  {
+    __m128 s = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for(; i + 4 <= num; i += 4)
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + i))), s));
+    s32tofloat_scalar(dst + i, src + i, num - i);
+  }
+  // Only stereo is vectorized, since that's what nearly everything that gets downmixed is. Every output sample only reads
+  // input from the same position or later, so these also work in place.
+  void downmixs16_sse2(int16_t* dst, const int16_t* src, size_t frames, uint32_t channels)
+  {
+    if(channels != 2)
+      return downmixs16_scalar(dst, src, frames, channels);
+    const __m128i one = _mm_set1_epi16(1);
+    size_t i          = 0;
+    for(; i + 8 <= frames; i += 8)
+    {
+      __m128i a = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(src + i * 2)), one); // L + R as 32-bit integers
+      __m128i b = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(src + i * 2 + 8)), one);
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(_mm_srai_epi32(a, 1), _mm_srai_epi32(b, 1)));
+    }
+    downmixs16_scalar(dst + i, src + i * 2, frames - i, channels);
+  }
+  void downmixfloat_sse2(float* dst, const float* src, size_t frames, uint32_t channels)
+  {
+    if(channels != 2)
+      return downmixfloat_scalar(dst, src, frames, channels);
+    const __m128 half = _mm_set1_ps(0.5f);
+    size_t i          = 0;
+    for(; i + 4 <= frames; i += 4)
+    {
+      __m128 a = _mm_loadu_ps(src + i * 2);
+      __m128 b = _mm_loadu_ps(src + i * 2 + 4);
+      __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+    }
+    downmixfloat_scalar(dst + i, src + i * 2, frames - i, channels);
+  }
+  // Polyphase filters are vectorized along the taps, which are always a multiple of 8
+  void resample_sse2(float* dst, const float* src, size_t num, const PolyphaseFilter& filter, uint64_t start)
+  {
+    ResampleCursor c(filter, start);
+    for(size_t i = 0; i < num; ++i, c.Next())
+    {
+      const float* h = c.Taps();
+      const float* x = src + c.idx;
+      __m128 a       = _mm_setzero_ps();
+      __m128 b       = _mm_setzero_ps();
+      for(uint32_t k = 0; k < filter.taps; k += 8)
+      {
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(h + k + 4)));
+      }
+      a = _mm_add_ps(a, b);
+      a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+      a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+      dst[i] = _mm_cvtss_f32(a);
+    }
+  }
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define TOAL_KERNELS_X86
+
+  // Moves each 3 byte sample into the top 3 bytes of a 32-bit lane and zeroes the bottom byte
+  inline __m128i s24mask() { return _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11); }
+
+  // Every 24-bit kernel handles the leftover samples at the end first and then works backwards 4 or 8 samples at a time.
+  // Each chunk is loaded before it is stored, and the 16 bytes we load never reach anything a later chunk has written.
+  TOAL_TARGET_SSSE3 void s24tos32_ssse3(int32_t* dst, const uint8_t* src, size_t num)
+  {
+    __m128i mask = s24mask();
+    size_t i     = num & ~(size_t)3;
+    s24tos32_scalar(dst + i, src + i * 3, num - i);
+    while(i > 0)
+    {
+      i -= 4;
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 3)), mask));
+    }
+  }
+  TOAL_TARGET_SSSE3 void s24tofloat_ssse3(float* dst, const uint8_t* src, size_t num)
+  {
+    __m128i mask = s24mask();
+    __m128 s     = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i     = num & ~(size_t)3;
+    s24tofloat_scalar(dst + i, src + i * 3, num - i);
+    while(i > 0)
+    {
+      i -= 4;
+      __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 3)), mask);
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), s));
+    }
+  }
+
+  // Each frame is shuffled inside a 16 or 32 byte window that starts at the frame. The window spills into the next frame,
+  // but those bytes map to themselves, so writing them back doesn't change anything. The last few frames don't have a
+  // full window left after them, so they're done with scalar code.
+  inline size_t shufflewindows(size_t frames, uint32_t size, uint32_t window)
+  {
+    return (frames * size < window) ? 0 : ((frames * size - window) / size) + 1;
+  }
+  TOAL_TARGET_SSSE3 void shuffleframes_ssse3(uint8_t* samples, size_t frames, const FrameShuffle& shuffle)
+  {
+    size_t i = 0;
+    if(shuffle.size <= 16)
+    {
+      __m128i m = _mm_loadu_si128((const __m128i*)shuffle.mask[0]);
+      for(size_t n = shufflewindows(frames, shuffle.size, 16); i < n; ++i, samples += shuffle.size)
+        _mm_storeu_si128((__m128i*)samples, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)samples), m));
+    }
+    else
+    { // Output bytes can come from either half, so each half gets shuffled from both and the results are merged
+      __m128i ll = _mm_loadu_si128((const __m128i*)shuffle.mask[0]);
+      __m128i lh = _mm_loadu_si128((const __m128i*)shuffle.mask[1]);
+      __m128i hl = _mm_loadu_si128((const __m128i*)shuffle.mask[2]);
+      __m128i hh = _mm_loadu_si128((const __m128i*)shuffle.mask[3]);
+      for(size_t n = shufflewindows(frames, shuffle.size, 32); i < n; ++i, samples += shuffle.size)
+      {
+        __m128i lo = _mm_loadu_si128((const __m128i*)samples);
+        __m128i hi = _mm_loadu_si128((const __m128i*)(samples + 16));
+        _mm_storeu_si128((__m128i*)samples, _mm_or_si128(_mm_shuffle_epi8(lo, ll), _mm_shuffle_epi8(hi, lh)));
+        _mm_storeu_si128((__m128i*)(samples + 16), _mm_or_si128(_mm_shuffle_epi8(lo, hl), _mm_shuffle_epi8(hi, hh)));
+      }
+    }
+    shuffleframes_scalar(samples, frames - i, shuffle);
+  }
+
+  TOAL_TARGET_AVX2 void s16mono_avx2(int16_t* dst, const int32_t* src, size_t num)
+  {
+    size_t i = 0;
+    for(; i + 16 <= num; i += 16)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 8));
+      // packs works on each 128-bit lane separately, so the middle two quadwords come out swapped
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+    }
+    s16mono_sse2(dst + i, src + i, num - i);
+  }
+  TOAL_TARGET_AVX2 void s16stereo_avx2(int16_t* dst, const int32_t* left, const int32_t* right, size_t num)
+  {
+    size_t i = 0;
+    for(; i + 8 <= num; i += 8)
+    {
+      __m256i l = _mm256_loadu_si256((const __m256i*)(left + i));
+      __m256i r = _mm256_loadu_si256((const __m256i*)(right + i));
+      // The per-lane unpacks and the per-lane pack cancel out, so this lands in order without a permute
+      _mm256_storeu_si256((__m256i*)(dst + i * 2),
+                          _mm256_packs_epi32(_mm256_unpacklo_epi32(l, r), _mm256_unpackhi_epi32(l, r)));
+    }
+    s16stereo_sse2(dst + i * 2, left + i, right + i, num - i);
+  }
+  TOAL_TARGET_AVX2 void floatmono_avx2(float* dst, const int32_t* src, size_t num, float scale)
+  {
+    __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= num; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + i))), s));
+    floatmono_sse2(dst + i, src + i, num - i, scale);
+  }
+  TOAL_TARGET_AVX2 void floatstereo_avx2(float* dst, const int32_t* left, const int32_t* right, size_t num, float scale)
+  {
+    __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= num; i += 8)
+    {
+      __m256 l  = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(left + i))), s);
+      __m256 r  = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(right + i))), s);
+      __m256 lo = _mm256_unpacklo_ps(l, r); // L0 R0 L1 R1 | L4 R4 L5 R5
+      __m256 hi = _mm256_unpackhi_ps(l, r); // L2 R2 L3 R3 | L6 R6 L7 R7
+      _mm256_storeu_ps(dst + i * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+      _mm256_storeu_ps(dst + i * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    floatstereo_sse2(dst + i * 2, left + i, right + i, num - i, scale);
+  }
+  TOAL_TARGET_AVX2 inline __m256i s24load_avx2(const uint8_t* src, __m256i mask)
+  { // Samples 0-3 go in the low lane and 4-7 in the high lane, so both lanes can use the same shuffle
+    __m256i v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src));
+    v         = _mm256_inserti128_si256(v, _mm_loadu_si128((const __m128i*)(src + 12)), 1);
+    return _mm256_shuffle_epi8(v, mask);
+  }
+  TOAL_TARGET_AVX2 void s24tos32_avx2(int32_t* dst, const uint8_t* src, size_t num)
+  {
+    __m256i mask = _mm256_broadcastsi128_si256(s24mask());
+    size_t i     = num & ~(size_t)7;
+    s24tos32_ssse3(dst + i, src + i * 3, num - i);
+    while(i > 0)
+    {
+      i -= 8;
+      _mm256_storeu_si256((__m256i*)(dst + i), s24load_avx2(src + i * 3, mask));
+    }
+  }
+  TOAL_TARGET_AVX2 void s24tofloat_avx2(float* dst, const uint8_t* src, size_t num)
+  {
+    __m256i mask = _mm256_broadcastsi128_si256(s24mask());
+    __m256 s     = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i     = num & ~(size_t)7;
+    s24tofloat_ssse3(dst + i, src + i * 3, num - i);
+    while(i > 0)
+    {
+      i -= 8;
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s24load_avx2(src + i * 3, mask)), s));
+    }
+  }
+  TOAL_TARGET_AVX2 void s32tofloat_avx2(float* dst, const int32_t* src, size_t num)
+  {
+    __m256 s = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for(; i + 8 <= num; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + i))), s));
+    s32tofloat_sse2(dst + i, src + i, num - i);
+  }
+
+  TOAL_TARGET_AVX2 inline void g711_avx2(int16_t* dst, const uint8_t* src, size_t num, const G711Table& table)
+  {
+    size_t i = num & ~(size_t)15;
+    g711_scalar(dst + i, src + i, num - i, table);
+    while(i > 0)
+    {
+      i -= 16;
+      __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i)); // Load all 16 before the stores can overwrite them
+      // Each gather reads 32 bits starting at the 16-bit entry we want, so the high half is thrown away by the shifts
+      __m256i lo = _mm256_i32gather_epi32((const int*)table.v, _mm256_cvtepu8_epi32(bytes), 2);
+      __m256i hi = _mm256_i32gather_epi32((const int*)table.v, _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), 2);
+      lo         = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+      hi         = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8));
+    }
+  }
+  TOAL_TARGET_AVX2 void mulaw_avx2(int16_t* dst, const uint8_t* src, size_t num) { g711_avx2(dst, src, num, MULAW_TABLE); }
+  TOAL_TARGET_AVX2 void alaw_avx2(int16_t* dst, const uint8_t* src, size_t num) { g711_avx2(dst, src, num, ALAW_TABLE); }
+
+  TOAL_TARGET_AVX2 inline void imastore_avx2(int16_t* dst, __m256i predictor, uint32_t channels)
+  {
+    // packs works per 128-bit lane, so the permute pulls both halves back together
+    __m128i packed =
+      _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packs_epi32(predictor, predictor), 0x08));
+    if(channels == 8)
+      _mm_storeu_si128((__m128i*)dst, packed);
+    else
+    {
+      int16_t frame[8];
+      _mm_storeu_si128((__m128i*)frame, packed);
+      memcpy(dst, frame, channels * sizeof(int16_t));
+    }
+  }
+
+  // Decodes every channel at once, one channel per lane. ADPCM can't be vectorized along a channel because each sample
+  // depends on the one before it, so this only pays off once there are enough channels to fill the lanes.
+  TOAL_TARGET_AVX2 void imaadpcm_avx2(int16_t* dst, const uint8_t* src, size_t groups, uint32_t channels)
+  {
+    if(channels < 4 || channels > 8)
+      return imaadpcm_scalar(dst, src, groups, channels);
+
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i active      = _mm256_cmpgt_epi32(_mm256_set1_epi32(channels), lanes);
+    __m256i header      = _mm256_maskload_epi32((const int*)src, active);
+    __m256i predictor   = _mm256_srai_epi32(_mm256_slli_epi32(header, 16), 16);
+    __m256i index       = _mm256_min_epi32(_mm256_and_si256(_mm256_srli_epi32(header, 16), _mm256_set1_epi32(0xFF)),
+                                           _mm256_set1_epi32(88));
+    const __m256i nibble = _mm256_set1_epi32(0xF);
+    const __m256i one    = _mm256_set1_epi32(1);
+    const __m256i two    = _mm256_set1_epi32(2);
+    const __m256i four   = _mm256_set1_epi32(4);
+    const __m256i three  = _mm256_set1_epi32(3);
+    const __m256i lo     = _mm256_set1_epi32(-32768);
+    const __m256i hi     = _mm256_set1_epi32(32767);
+    imastore_avx2(dst, predictor, channels);
+    dst += channels;
+    const uint8_t* data = src + channels * 4;
+    for(size_t g = 0; g < groups; ++g, data += channels * 4)
+    {
+      __m256i word = _mm256_maskload_epi32((const int*)data, active); // Each lane gets 8 nibbles for its channel
+      for(int k = 0; k < 8; ++k, dst += channels)
+      {
+        __m256i n    = _mm256_and_si256(word, nibble);
+        word         = _mm256_srli_epi32(word, 4);
+        __m256i step = _mm256_i32gather_epi32((const int*)IMA_STEPS, index, 4);
+        __m256i diff = _mm256_srai_epi32(step, 3);
+        diff = _mm256_add_epi32(diff, _mm256_and_si256(_mm256_srai_epi32(step, 2),
+                                                       _mm256_cmpeq_epi32(_mm256_and_si256(n, one), one)));
+        diff = _mm256_add_epi32(diff, _mm256_and_si256(_mm256_srai_epi32(step, 1),
+                                                       _mm256_cmpeq_epi32(_mm256_and_si256(n, two), two)));
+        diff = _mm256_add_epi32(diff, _mm256_and_si256(step, _mm256_cmpeq_epi32(_mm256_and_si256(n, four), four)));
+        __m256i sign = _mm256_srai_epi32(_mm256_slli_epi32(n, 28), 31); // All ones if bit 3 is set
+        diff         = _mm256_sub_epi32(_mm256_xor_si256(diff, sign), sign);
+        predictor    = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(predictor, diff), lo), hi);
+
+        // The index table is -1 for 0-3, and 2, 4, 6, 8 for 4-7, which is (n - 3) * 2
+        __m256i m   = _mm256_and_si256(n, _mm256_set1_epi32(7));
+        __m256i adj = _mm256_blendv_epi8(_mm256_set1_epi32(-1), _mm256_slli_epi32(_mm256_sub_epi32(m, three), 1),
+                                         _mm256_cmpgt_epi32(m, three));
+        index = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(index, adj), _mm256_setzero_si256()),
+                                 _mm256_set1_epi32(88));
+        imastore_avx2(dst, predictor, channels);
+      }
+    }
+  }
+
+  TOAL_TARGET_AVX2 void downmixs16_avx2(int16_t* dst, const int16_t* src, size_t frames, uint32_t channels)
+  {
+    if(channels != 2)
+      return downmixs16_scalar(dst, src, frames, channels);
+    const __m256i one = _mm256_set1_epi16(1);
+    size_t i          = 0;
+    for(; i + 16 <= frames; i += 16)
+    {
+      __m256i a = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(src + i * 2)), one);
+      __m256i b = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(src + i * 2 + 16)), one);
+      // The pack works within each 128-bit lane, so the middle two quarters come out swapped
+      __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(a, 1), _mm256_srai_epi32(b, 1));
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(r, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    downmixs16_sse2(dst + i, src + i * 2, frames - i, channels);
+  }
+  TOAL_TARGET_AVX2 void downmixfloat_avx2(float* dst, const float* src, size_t frames, uint32_t channels)
+  {
+    if(channels != 2)
+      return downmixfloat_scalar(dst, src, frames, channels);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t i          = 0;
+    for(; i + 8 <= frames; i += 8)
+    {
+      __m256 a = _mm256_loadu_ps(src + i * 2);
+      __m256 b = _mm256_loadu_ps(src + i * 2 + 8);
+      __m256 r = _mm256_mul_ps(_mm256_hadd_ps(a, b), half); // Same lane swap as the 16-bit version
+      _mm256_storeu_ps(dst + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    downmixfloat_sse2(dst + i, src + i * 2, frames - i, channels);
+  }
+  TOAL_TARGET_AVX2 void resample_avx2(float* dst, const float* src, size_t num, const PolyphaseFilter& filter,
+                                      uint64_t start)
+  {
+    ResampleCursor c(filter, start);
+    for(size_t i = 0; i < num; ++i, c.Next())
+    {
+      const float* h = c.Taps();
+      const float* x = src + c.idx;
+      __m256 a       = _mm256_setzero_ps();
+      for(uint32_t k = 0; k < filter.taps; k += 8)
+        a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(h + k)));
+      __m128 r = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      r        = _mm_add_ps(r, _mm_movehl_ps(r, r));
+      r        = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+      dst[i]   = _mm_cvtss_f32(r);
+    }
+  }
+
+  bool HasSSSE3()
+  {
+  #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+  #else
+    return __builtin_cpu_supports("ssse3");
+  #endif
+  }
+  bool HasAVX2()
+  {
+  #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7)
+      return false;
+    __cpuid(info, 1);
+    if(!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) // OSXSAVE and AVX
+      return false;
+    if((_xgetbv(0) & 6) != 6) // The OS has to save the YMM registers for us
+      return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  #else
+    return __builtin_cpu_supports("avx2");
+  #endif
+  }
+#endif
+
+  Kernels PickKernels()
+  {
+    Kernels k;
+    k.PlanarToS16Mono     = &s16mono_sse2;
+    k.PlanarToS16Stereo   = &s16stereo_sse2;
+    k.PlanarToFloatMono   = &floatmono_sse2;
+    k.PlanarToFloatStereo = &floatstereo_sse2;
+    k.S24ToS32            = &s24tos32_scalar; // There's no byte shuffle before SSSE3
+    k.S24ToFloat          = &s24tofloat_scalar;
+    k.S32ToFloat          = &s32tofloat_sse2;
+    k.MulawToS16          = &mulaw_scalar;
+    k.AlawToS16           = &alaw_scalar;
+    k.ShuffleFrames       = &shuffleframes_scalar;
+    k.ImaAdpcmBlock       = &imaadpcm_scalar;
+    k.ImaAdpcmEncodeBlock = &imaadpcmencode_scalar;
+    k.Resample            = &resample_sse2;
+    k.DownmixS16          = &downmixs16_sse2;
+    k.DownmixFloat        = &downmixfloat_sse2;
+    k.name                = "SSE2";
+
+#ifdef TOAL_KERNELS_X86
+    if(HasSSSE3())
+    {
+      k.S24ToS32      = &s24tos32_ssse3;
+      k.S24ToFloat    = &s24tofloat_ssse3;
+      k.ShuffleFrames = &shuffleframes_ssse3;
+      k.name          = "SSSE3";
+    }
+    if(HasAVX2())
+    {
+      k.PlanarToS16Mono     = &s16mono_avx2;
+      k.PlanarToS16Stereo   = &s16stereo_avx2;
+      k.PlanarToFloatMono   = &floatmono_avx2;
+      k.PlanarToFloatStereo = &floatstereo_avx2;
+      k.S24ToS32            = &s24tos32_avx2;
+      k.S24ToFloat          = &s24tofloat_avx2;
+      k.S32ToFloat          = &s32tofloat_avx2;
+      k.MulawToS16          = &mulaw_avx2;
+      k.AlawToS16           = &alaw_avx2;
+      k.ImaAdpcmBlock       = &imaadpcm_avx2;
+      k.Resample            = &resample_avx2;
+      k.DownmixS16          = &downmixs16_avx2;
+      k.DownmixFloat        = &downmixfloat_avx2;
+      k.name                = "AVX2";
+    }
+#endif
+    return k;
+  }
+}
+
+const Kernels& Kernels::Get()
+{
+  static const Kernels kernels = PickKernels();
+  return kernels;
+}
+
+FrameShuffle FrameShuffle::Build(const uint8_t* map, uint32_t channels, uint32_t bytes)
+{
+  FrameShuffle r;
+  r.size = (!map || channels * bytes > sizeof(r.src)) ? 0 : channels * bytes;
+  for(uint32_t i = 0; i < sizeof(r.src); ++i)
+    r.src[i] = (uint8_t)i;
+  for(uint32_t i = 0; i < r.size; ++i)
+    r.src[i] = (uint8_t)(map[i / bytes] * bytes + (i % bytes));
+  for(uint32_t i = 0; i < 16; ++i)
+  { // 0x80 zeroes the byte, so each half only picks up the bytes that actually come from it
+    r.mask[0][i] = (r.src[i] < 16) ? r.src[i] : 0x80;
+    r.mask[1][i] = (r.src[i] >= 16) ? r.src[i] - 16 : 0x80;
+    r.mask[2][i] = (r.src[i + 16] < 16) ? r.src[i + 16] : 0x80;
+    r.mask[3][i] = (r.src[i + 16] >= 16) ? r.src[i + 16] - 16 : 0x80;
+  }
+  return r;
+}
+
+PolyphaseFilter::PolyphaseFilter(uint32_t from, uint32_t to)
+{
+  const uint32_t MAXPHASES = 1024;
+  const double PI          = 3.14159265358979323846;
+  const double BETA        = 8.6; // Kaiser window shape, which gives roughly 90 dB of stopband attenuation
+
+  uint32_t a = from, b = to;
+  while(b)
+  {
+    uint32_t t = a % b;
+    a          = b;
+    b          = t;
+  }
+  in     = from / a;
+  out    = to / a;
+  phases = (out < MAXPHASES) ? out : MAXPHASES;
+
+  // When downsampling, the cutoff has to drop to the new nyquist, and the filter gets longer to keep the same slope
+  double ratio = (to < from) ? (double)to / from : 1.0;
+  taps         = (uint32_t)ceil(64.0 / ratio);
+  taps         = (taps > 512) ? 512 : ((taps + 7) & ~7u);
+  double fc    = 0.46 * ratio; // Cycles per input sample. This leaves room for the transition band below nyquist.
+  double half  = taps / 2;
+
+  auto bessel = [](double x) { // Zeroth order modified Bessel function, which converges quickly for the x we use
+    double sum = 1.0, term = 1.0;
+    for(int k = 1; k < 32; ++k)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  };
+  double norm = bessel(BETA);
+
+  bank.reset(new float[(size_t)phases * taps]);
+  for(uint32_t p = 0; p < phases; ++p)
+  {
+    float* h   = bank.get() + (size_t)p * taps;
+    double sum = 0.0;
+    for(uint32_t k = 0; k < taps; ++k)
+    {
+      double x = (half - 1 - k) + (double)p / phases; // Distance from this tap to the output sample, in input samples
+      double y = 2.0 * fc * x * PI;
+      double w = 1.0 - (x / half) * (x / half);
+      double v = 2.0 * fc * ((x == 0.0) ? 1.0 : sin(y) / y) * ((w > 0.0) ? bessel(BETA * sqrt(w)) / norm : 0.0);
+      h[k]     = (float)v;
+      sum += v;
+    }
+    for(uint32_t k = 0; k < taps; ++k) // Every phase gets unity gain, otherwise the ripple between them is audible
+      h[k] = (float)(h[k] / sum);
+  }
+}
@@ -0,0 +1,88 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+// Notice: This header file does not need to be included in binary distributions of the library
+
+#ifndef TOAL__KERNELS_H
+#define TOAL__KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+namespace tinyoal {
+  // Byte shuffle that reorders the channels of one interleaved frame of up to 32 bytes, applied by Kernels::ShuffleFrames
+  struct FrameShuffle
+  {
+    // Builds a shuffle for frames of channels samples that are bytes long each, where output channel i is taken from
+    // input channel map[i]. If map is NULL, size is 0 and there is nothing to shuffle.
+    static FrameShuffle Build(const uint8_t* map, uint32_t channels, uint32_t bytes);
+
+    uint8_t src[32];     // Output byte i is taken from input byte src[i]. Bytes past the end of the frame stay put.
+    uint8_t mask[4][16]; // The same table split into byte shuffle masks for the low and high half of a 32 byte window
+    uint32_t size;       // Bytes per frame
+  };
+
+  // Bank of windowed sinc filters that converts from one sample rate to another, applied by Kernels::Resample. There is
+  // one filter per phase, which is where an output sample lands between two input samples.
+  struct PolyphaseFilter
+  {
+    PolyphaseFilter(uint32_t from, uint32_t to);
+    // Picks the filter for an output sample that sits rem / out of the way past an input sample
+    inline uint32_t Phase(uint32_t rem) const
+    {
+      return (phases == out) ? rem : (uint32_t)(((uint64_t)rem * phases) / out);
+    }
+
+    std::unique_ptr<float[]> bank; // phases * taps coefficients
+    uint32_t taps;                 // Always a multiple of 8
+    uint32_t phases;               // Equal to out unless out is too large to give every phase its own filter
+    uint32_t in;                   // Both rates divided by their greatest common divisor
+    uint32_t out;
+  };
+
+  // Table of sample conversion kernels. The best implementation the CPU supports is picked once, the first time Get() is
+  // called, and every kernel falls back to plain scalar code for whatever is left over after the vectorized loop.
+  struct Kernels
+  {
+    // Planar 32-bit integer channels (as handed out by libFLAC) to interleaved signed 16-bit samples
+    void (*PlanarToS16Mono)(int16_t* dst, const int32_t* src, size_t num);
+    void (*PlanarToS16Stereo)(int16_t* dst, const int32_t* left, const int32_t* right, size_t num);
+    // Planar 32-bit integer channels to interleaved floats, multiplying every sample by scale
+    void (*PlanarToFloatMono)(float* dst, const int32_t* src, size_t num, float scale);
+    void (*PlanarToFloatStereo)(float* dst, const int32_t* left, const int32_t* right, size_t num, float scale);
+    // Packed little-endian 24-bit samples to left-justified 32-bit integers or to floats. These walk backwards, so dst can
+    // point at the same memory as src for an in-place expansion, as long as the buffer has room for num 32-bit samples.
+    void (*S24ToS32)(int32_t* dst, const uint8_t* src, size_t num);
+    void (*S24ToFloat)(float* dst, const uint8_t* src, size_t num);
+    // 32-bit integer samples to floats, dst can point at the same memory as src
+    void (*S32ToFloat)(float* dst, const int32_t* src, size_t num);
+    // 8-bit G.711 mu-law and A-law samples to signed 16-bit samples through a lookup table. These walk backwards like the
+    // 24-bit conversions, so dst can point at the same memory as src.
+    void (*MulawToS16)(int16_t* dst, const uint8_t* src, size_t num);
+    void (*AlawToS16)(int16_t* dst, const uint8_t* src, size_t num);
+    // Reorders the channels of every frame in place
+    void (*ShuffleFrames)(uint8_t* samples, size_t frames, const FrameShuffle& shuffle);
+    // Decodes one IMA ADPCM block: a 4 byte header per channel followed by groups of 8 samples per channel, stored as
+    // 4 bytes per channel. Writes 1 + groups * 8 interleaved 16-bit frames to dst.
+    void (*ImaAdpcmBlock)(int16_t* dst, const uint8_t* src, size_t groups, uint32_t channels);
+    // Encodes 1 + groups * 8 interleaved 16-bit frames into one IMA ADPCM block laid out like above. indices holds the
+    // step index of each channel, which is carried over from the previous block. This only runs at load time, so it's
+    // always scalar.
+    void (*ImaAdpcmEncodeBlock)(uint8_t* dst, const int16_t* src, size_t groups, uint32_t channels, uint8_t* indices);
+
+    // Resamples one channel of planar floats. Output sample i is centered on input sample (start + i) * in / out, and
+    // src[0] is taps / 2 - 1 samples before the first input sample, so the caller has to pad the channel with that many
+    // zeros in front and taps / 2 zeros behind.
+    void (*Resample)(float* dst, const float* src, size_t num, const PolyphaseFilter& filter, uint64_t start);
+    // Averages every channel of each interleaved frame into a single mono sample. dst can point at the same memory as src.
+    void (*DownmixS16)(int16_t* dst, const int16_t* src, size_t frames, uint32_t channels);
+    void (*DownmixFloat)(float* dst, const float* src, size_t frames, uint32_t channels);
+
+    const char* name; // Name of the instruction set these kernels were picked for, so it can be logged
+
+    static const Kernels& Get();
+  };
+}
+
+#endif
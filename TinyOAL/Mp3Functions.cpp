@@ -5,13 +5,20 @@
 #include "Mp3Functions.h"
 #include "tinyoal/TinyOAL.h"
 
-#ifdef BUN_PLATFORM_WIN32
-  #include "win32_includes.h"
-
-  #define MP3_MODULE "mpg123.dll"
+#ifdef TINYOAL_STATIC_CODECS
+  #define MP3_MODULE       ""
+  #define LOADDYNLIB(s)    (void*)(~0)
+  #define GETDYNFUNC(p, s) (&s)
+  #define FREEDYNLIB(p)    ((void)0)
 #else
-  #include <dlfcn.h>
-  #define MP3_MODULE "libmpg123.so.0"
+  #ifdef BUN_PLATFORM_WIN32
+    #include "win32_includes.h"
+
+    #define MP3_MODULE "mpg123.dll"
+  #else
+    #include <dlfcn.h>
+    #define MP3_MODULE "libmpg123.so.0"
+  #endif
 #endif
 
 #define DYNFUNC(v, t, n)         \
@@ -48,6 +55,10 @@ Mp3Functions::Mp3Functions(const char* force)
     DYNFUNC(fn_mpgInfo, LPMPGINFO, mpg123_info);
     DYNFUNC(fn_mpgScan, LPMPGSCAN, mpg123_scan);
     DYNFUNC(fn_mpgLength, LPMPGLENGTH, mpg123_length);
+    DYNFUNC(fn_mpgSupportedDecoders, LPMPGSUPPORTEDDECODERS, mpg123_supported_decoders);
+    DYNFUNC(fn_mpgCurrentDecoder, LPMPGCURRENTDECODER, mpg123_current_decoder);
+    DYNFUNC(fn_mpgIndex, LPMPGINDEX, mpg123_index);
+    DYNFUNC(fn_mpgSetIndex, LPMPGSETINDEX, mpg123_set_index);
     DYNFUNC(fn_mpgID3, LPMPGID3, mpg123_id3);
     DYNFUNC(fn_mpgReplaceReader, LPMPGREPLACEREADER, mpg123_replace_reader_handle);
 
@@ -59,6 +70,8 @@ Mp3Functions::Mp3Functions(const char* force)
       FREEDYNLIB(_mpgDLL);
       bun::bun_Fill(*this, 0);
     }
+    else
+      _decoder = _pickDecoder();
   }
   else
     TINYOAL_LOG(1, "Could not find the mpg123 DLL (or it may be missing one of its dependencies)");
@@ -70,4 +83,32 @@ Mp3Functions::~Mp3Functions()
     fn_mpgExit();
   if(_mpgDLL)
     FREEDYNLIB(_mpgDLL);
-}
\ No newline at end of file
+}
+
+// Picks the fastest decoder this CPU supports out of the ones the library was built with
+const char* Mp3Functions::_pickDecoder()
+{
+  static const char* PREFERRED[] = { "AVX", "x86-64", "SSE", "NEON64", "NEON", "3DNowExt", "3DNow", "MMX", "i586" };
+
+  const char** supported = !fn_mpgSupportedDecoders ? nullptr : fn_mpgSupportedDecoders();
+  if(supported)
+  {
+    for(const char* name : PREFERRED)
+      for(const char** d = supported; *d != nullptr; ++d)
+        if(!strcmp(*d, name))
+        {
+          TINYOAL_LOG(4, "Asking mpg123 for its %s decoder", name);
+          return name;
+        }
+  }
+  TINYOAL_LOG(4, "No optimized mpg123 decoder found, letting mpg123 pick one");
+  return nullptr;
+}
+
+mpg123_handle* Mp3Functions::New(int* err)
+{
+  mpg123_handle* h = fn_mpgNew(_decoder, err);
+  if(h && !_current && fn_mpgCurrentDecoder && (_current = fn_mpgCurrentDecoder(h)) != nullptr)
+    TINYOAL_LOG(4, "mpg123 is decoding with its %s decoder", _current);
+  return h;
+}
@@ -28,6 +28,10 @@ namespace tinyoal {
   typedef int (*LPMPGINFO)(mpg123_handle*, struct mpg123_frameinfo*);
   typedef int (*LPMPGSCAN)(mpg123_handle*);
   typedef off_t (*LPMPGLENGTH)(mpg123_handle*);
+  typedef const char** (*LPMPGSUPPORTEDDECODERS)(void);
+  typedef const char* (*LPMPGCURRENTDECODER)(mpg123_handle*);
+  typedef int (*LPMPGINDEX)(mpg123_handle*, off_t**, off_t*, size_t*);
+  typedef int (*LPMPGSETINDEX)(mpg123_handle*, off_t*, off_t, size_t);
   typedef int (*LPMPGID3)(mpg123_handle*, mpg123_id3v1**, mpg123_id3v2**);
   typedef int (*LPMPGREPLACEREADER)(mpg123_handle*, ssize_t (*r_read)(void*, void*, size_t),
                                     off_t (*r_lseek)(void*, off_t, int), void (*cleanup)(void*));
@@ -38,6 +42,12 @@ namespace tinyoal {
     Mp3Functions(const char* force);
     ~Mp3Functions();
     inline bool Failure() { return _mpgDLL == nullptr; }
+    // Name of the decoder every new handle asks for, or NULL to let mpg123 pick
+    inline const char* GetDecoder() const { return _decoder; }
+    // Name of the decoder mpg123 actually gave the first handle, or NULL if none has been created yet
+    inline const char* GetCurrentDecoder() const { return _current; }
+    // Creates a handle that asks for our decoder, in place of calling fn_mpgNew directly
+    mpg123_handle* New(int* err);
 
     LPMPGINIT fn_mpgInit;
     LPMPGEXIT fn_mpgExit;
@@ -56,11 +66,19 @@ namespace tinyoal {
     LPMPGINFO fn_mpgInfo;
     LPMPGSCAN fn_mpgScan;
     LPMPGLENGTH fn_mpgLength;
+    LPMPGSUPPORTEDDECODERS fn_mpgSupportedDecoders;
+    LPMPGCURRENTDECODER fn_mpgCurrentDecoder;
+    LPMPGINDEX fn_mpgIndex;
+    LPMPGSETINDEX fn_mpgSetIndex;
     LPMPGID3 fn_mpgID3;
     LPMPGREPLACEREADER fn_mpgReplaceReader;
 
   protected:
+    const char* _pickDecoder();
+
     void* _mpgDLL;
+    const char* _decoder;
+    const char* _current;
   };
 }
 
@@ -5,6 +5,7 @@
 #include "OALEngine.h"
 #include "tinyoal/TinyOAL.h"
 #include "WaveFunctions.h"
+#include "ReadAhead.h"
 #include "AL/al.h"
 #include "AL/alc.h"
 #include "AL/alext.h"
@@ -22,7 +23,7 @@ typedef struct
 } ALDEVICEINFO, *LPALDEVICEINFO;
 
 OALEngine::OALEngine(unsigned char bufferCount, const char* dllpath) :
-  defNumBuf(bufferCount), _bufalloc(bufferCount * sizeof(ALuint), 5)
+  defNumBuf(bufferCount), _bufalloc(bufferCount * sizeof(ALuint), 5), _mapbuffer()
 {
   // We do this instead of std::string because the pointer being NULL has meaning.
   if(dllpath)
@@ -154,6 +155,7 @@ bool OALEngine::SetDevice(const char* device)
   {
     TINYOAL_LOG(4, "Opened Device: %s", device);
     oalFuncs->alcMakeContextCurrent(pContext);
+    _loadExtensions();
     return true;
   }
   oalFuncs->alcCloseDevice(pDevice);
@@ -161,6 +163,26 @@ bool OALEngine::SetDevice(const char* device)
   return false;
 }
 
+void OALEngine::_loadExtensions()
+{ // Extension functions can differ between contexts, so these are fetched again whenever the device changes
+  _mapbuffer = MapBufferFuncs();
+  if(!oalFuncs->alIsExtensionPresent("AL_SOFT_map_buffer"))
+    return;
+
+  _mapbuffer.alBufferStorageSOFT     = (LPALBUFFERSTORAGESOFT)oalFuncs->alGetProcAddress("alBufferStorageSOFT");
+  _mapbuffer.alMapBufferSOFT         = (LPALMAPBUFFERSOFT)oalFuncs->alGetProcAddress("alMapBufferSOFT");
+  _mapbuffer.alUnmapBufferSOFT       = (LPALUNMAPBUFFERSOFT)oalFuncs->alGetProcAddress("alUnmapBufferSOFT");
+  _mapbuffer.alFlushMappedBufferSOFT = (LPALFLUSHMAPPEDBUFFERSOFT)oalFuncs->alGetProcAddress("alFlushMappedBufferSOFT");
+  if(!_mapbuffer.alBufferStorageSOFT || !_mapbuffer.alMapBufferSOFT || !_mapbuffer.alUnmapBufferSOFT ||
+     !_mapbuffer.alFlushMappedBufferSOFT)
+  {
+    TINYOAL_LOG(2, "AL_SOFT_map_buffer is present but its functions are missing, buffers will be copied instead");
+    _mapbuffer = MapBufferFuncs();
+  }
+  else
+    TINYOAL_LOG(4, "Using AL_SOFT_map_buffer to decode straight into OpenAL buffers");
+}
+
 uint32_t OALEngine::GetWaveFormat(WaveFileInfo& wave)
 {
   uint16_t bits = wave.wfEXT.Format.wBitsPerSample;
@@ -208,6 +230,17 @@ uint32_t OALEngine::GetWaveFormat(WaveFileInfo& wave)
   return 0;
 }
 
+uint32_t OALEngine::GetFrequency()
+{
+  if(!oalFuncs)
+    return 0;
+  ALCdevice* pDevice = oalFuncs->alcGetContextsDevice(oalFuncs->alcGetCurrentContext());
+  ALCint freq        = 0;
+  if(pDevice)
+    oalFuncs->alcGetIntegerv(pDevice, ALC_FREQUENCY, 1, &freq);
+  return (uint32_t)freq;
+}
+
 size_t OALEngine::GetDefaultDevice(char* out, size_t len)
 {
   auto p    = oalFuncs->alcGetString(nullptr, ALC_DEFAULT_DEVICE_SPECIFIER);
@@ -281,14 +314,15 @@ std::pair<uint16_t, uint16_t> OALEngine::ExtractFormat(uint32_t format)
 
 ALuint* OALEngine::_alloc() { return (ALuint*)_bufalloc.Alloc(); }
 void OALEngine::_dealloc(ALuint* buf) { _bufalloc.Dealloc(buf); }
-OALEngine::OALSource::OALSource(OALEngine* engine, OALEngine::OALSource::LoadBuffer loadBuffer, int format, uint32_t freq,
-                                size_t bufsize) :
+OALEngine::OALSource::OALSource(OALEngine* engine, OALEngine::OALSource::LoadBuffer loadBuffer,
+                                OALEngine::OALSource::PeekBuffer peekBuffer, int format, uint32_t freq, size_t bufsize) :
   _source((uint32_t)-1),
   _engine(engine),
   uiBuffers(nullptr),
   _bufstart(0),
   _queuebuflen(0),
   _loadBuffer(loadBuffer),
+  _peekBuffer(peekBuffer),
   _bufsize(bufsize),
   _freq(freq),
   _format(format)
@@ -299,6 +333,13 @@ OALEngine::OALSource::OALSource(OALEngine* engine, OALEngine::OALSource::LoadBuf
     uiBuffers = _engine->_alloc();
     memset(uiBuffers, 0, sizeof(ALuint) * _engine->defNumBuf);
     _engine->oalFuncs->alGenBuffers(_engine->defNumBuf, uiBuffers);
+    if(_engine->_mapbuffer.alBufferStorageSOFT)
+    {
+      _mapped.reset(new char*[_engine->defNumBuf]());
+      for(ALint i = 0; i < _engine->defNumBuf && _mapped; ++i)
+        if(!(_mapped[i] = _map(uiBuffers[i])))
+          _unmap(); // Not every format can be mapped (ADPCM can't, for one), so those copy through _buffer instead
+    }
   }
   else
     TINYOAL_LOG(1, "Failed to allocate memory for decoded audio data");
@@ -314,6 +355,7 @@ OALEngine::OALSource::~OALSource()
 
   if(uiBuffers)
   {
+    _unmap(); // OpenAL won't delete a buffer that's still mapped
     _engine->oalFuncs->alDeleteBuffers(_engine->defNumBuf, uiBuffers);
     _engine->_dealloc(uiBuffers);
   }
@@ -424,6 +466,17 @@ void OALEngine::OALSource::_processBuffers(void* context)
   ALint iBuffersProcessed = 0;
   _engine->oalFuncs->alGetSourcei(_source, AL_BUFFERS_PROCESSED, &iBuffersProcessed);
 
+  // Anything the stream reads ahead while we refill has to arrive before the buffers still queued run out
+  ReadAhead* readahead = TinyOAL::Instance()->GetReadAhead();
+  auto [channels, bits] = ExtractFormat(_format);
+  if(iBuffersProcessed && readahead && channels && _freq)
+  {
+    ALint iBuffersQueued = 0;
+    _engine->oalFuncs->alGetSourcei(_source, AL_BUFFERS_QUEUED, &iBuffersQueued);
+    uint64_t duration = (_bufsize * 1000000ULL) / ((uint64_t)channels * (bits >> 3) * _freq);
+    readahead->SetDeadline(ReadAhead::Now() + (iBuffersQueued - iBuffersProcessed) * duration);
+  }
+
   // For each processed buffer, remove it from the Source Queue, read next chunk of audio
   // data from disk, fill buffer with new data, and add it to the Source Queue
   while(iBuffersProcessed)
@@ -433,27 +486,78 @@ void OALEngine::OALSource::_processBuffers(void* context)
     _engine->oalFuncs->alSourceUnqueueBuffers(_source, 1, &uiBuffer);
 
     // Read more audio data (if there is any)
-    unsigned long ulBytesWritten = (*_loadBuffer)(_bufsize, _buffer, context);
-
-    if(ulBytesWritten)
-    {
-      _engine->oalFuncs->alBufferData(uiBuffer, (ALenum)_format, _buffer, ulBytesWritten, (ALsizei)_freq);
+    if(_load(uiBuffer, context))
       _engine->oalFuncs->alSourceQueueBuffers(_source, 1, &uiBuffer);
-    }
 
     iBuffersProcessed--;
   }
+
+  if(readahead)
+    readahead->SetDeadline(0);
 }
 void OALEngine::OALSource::_fillBuffers(void* context)
 {
   _bufstart    = 0;
   _queuebuflen = 0;
   for(ALint i = 0; i < _engine->defNumBuf; i++)
-  {
-    unsigned long ulBytesWritten = (*_loadBuffer)(_bufsize, _buffer, context);
-    if(ulBytesWritten)
-      _engine->oalFuncs->alBufferData(uiBuffers[_queuebuflen++], (ALenum)_format, _buffer, ulBytesWritten, (ALsizei)_freq);
+    if(_load(uiBuffers[_queuebuflen], context))
+      ++_queuebuflen;
+}
+// Fills buffer with the next chunk of audio and returns how many bytes it got, or 0 if there was nothing left
+unsigned long OALEngine::OALSource::_load(ALuint buffer, void* context)
+{
+  if(_mapped)
+  { // Decode straight into the memory OpenAL plays from, so there's nothing left for alBufferData to copy
+    ALint i = 0;
+    while(uiBuffers[i] != buffer)
+      ++i;
+    if(!_mapped[i] && !(_mapped[i] = _map(buffer)))
+      _unmap(); // Give up on mapping instead of trying again on every refill
+    else
+    {
+      unsigned long ulBytesWritten = (*_loadBuffer)(_bufsize, _mapped[i], context);
+      if(ulBytesWritten == _bufsize)
+      {
+        _engine->_mapbuffer.alFlushMappedBufferSOFT(buffer, 0, (ALsizei)ulBytesWritten);
+        return ulBytesWritten;
+      }
+      if(!ulBytesWritten)
+        return 0;
+
+      // OpenAL always plays a buffer's entire storage, so the short read at the end of a stream has to be uploaded with
+      // alBufferData, which can't touch a mapped buffer. It gets mapped again the next time it's filled.
+      memcpy(_buffer, _mapped[i], ulBytesWritten);
+      _engine->_mapbuffer.alUnmapBufferSOFT(buffer);
+      _mapped[i] = nullptr;
+      _engine->oalFuncs->alBufferData(buffer, (ALenum)_format, _buffer, ulBytesWritten, (ALsizei)_freq);
+      return ulBytesWritten;
+    }
   }
+
+  // alBufferData copies whatever we give it, so if the samples are already in memory we point it straight at them
+  const char* data             = _peekBuffer ? (*_peekBuffer)(_bufsize, context) : nullptr;
+  unsigned long ulBytesWritten = data ? (unsigned long)_bufsize : (*_loadBuffer)(_bufsize, _buffer, context);
+  if(ulBytesWritten)
+    _engine->oalFuncs->alBufferData(buffer, (ALenum)_format, data ? data : _buffer, ulBytesWritten, (ALsizei)_freq);
+  return ulBytesWritten;
+}
+char* OALEngine::OALSource::_map(ALuint buffer)
+{
+  const ALbitfieldSOFT access = AL_MAP_WRITE_BIT_SOFT | AL_MAP_PERSISTENT_BIT_SOFT;
+  _engine->oalFuncs->alGetError(); // Clear last error
+  _engine->_mapbuffer.alBufferStorageSOFT(buffer, (ALenum)_format, nullptr, (ALsizei)_bufsize, (ALsizei)_freq, access);
+  if(_engine->oalFuncs->alGetError() != AL_NO_ERROR)
+    return nullptr;
+  return (char*)_engine->_mapbuffer.alMapBufferSOFT(buffer, 0, (ALsizei)_bufsize, access);
+}
+void OALEngine::OALSource::_unmap()
+{
+  if(!_mapped)
+    return;
+  for(ALint i = 0; i < _engine->defNumBuf; ++i)
+    if(_mapped[i])
+      _engine->_mapbuffer.alUnmapBufferSOFT(uiBuffers[i]);
+  _mapped.reset();
 }
 void OALEngine::OALSource::_queueBuffers()
 {
@@ -463,10 +567,11 @@ void OALEngine::OALSource::_queueBuffers()
     _engine->oalFuncs->alSourceQueueBuffers(_source, 1, &uiBuffers[i % nbuffers]);
   _queuebuflen = 0;
 }
-Source* OALEngine::GenSource(Source::LoadBuffer loadBuffer, size_t bufsize, int format, uint32_t freq)
+Source* OALEngine::GenSource(Source::LoadBuffer loadBuffer, Source::PeekBuffer peekBuffer, size_t bufsize, int format,
+                             uint32_t freq)
 {
   if(!oalFuncs)
     return nullptr;
-  return new OALSource(this, loadBuffer, format, freq, bufsize);
+  return new OALSource(this, loadBuffer, peekBuffer, format, freq, bufsize);
 }
 void OALEngine::DestroySource(Source* source) { delete source; }
\ No newline at end of file
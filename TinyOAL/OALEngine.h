@@ -8,6 +8,7 @@
 
 #include "buntils/compiler.h"
 #include "loadoal.h"
+#include "AL/alext.h"
 #include "Engine.h"
 #include "buntils/BlockAlloc.h"
 #include <memory>
@@ -18,7 +19,8 @@ namespace tinyoal {
     class OALSource : public Source
     {
     public:
-      OALSource(OALEngine* engine, LoadBuffer loadBuffer, int format, uint32_t freq, size_t bufsize);
+      OALSource(OALEngine* engine, LoadBuffer loadBuffer, PeekBuffer peekBuffer, int format, uint32_t freq,
+                size_t bufsize);
       ~OALSource();
       virtual bool Update(void* context, bool isPlaying) override;
       virtual bool Play(float volume, float pitch, float (&pos)[3]) override;
@@ -36,6 +38,9 @@ namespace tinyoal {
       void _processBuffers(void* context);
       void _fillBuffers(void* context);
       void _queueBuffers();
+      unsigned long _load(ALuint buffer, void* context);
+      char* _map(ALuint buffer);
+      void _unmap();
 
       ALuint _source;
       ALuint* uiBuffers;
@@ -43,10 +48,12 @@ namespace tinyoal {
       char _queuebuflen;
       OALEngine* _engine;
       LoadBuffer _loadBuffer;
+      PeekBuffer _peekBuffer;
       const size_t _bufsize;
       const int _format; 
       const uint32_t _freq;
       char* _buffer;
+      std::unique_ptr<char*[]> _mapped; // Persistent AL_SOFT_map_buffer mapping of each buffer, if the driver has one
     };
 
   public:
@@ -58,7 +65,9 @@ namespace tinyoal {
     virtual size_t GetDefaultDevice(char* out, size_t len) override;
     virtual uint32_t GetFormat(uint16_t channels, uint16_t bits, bool rear) override;
     virtual uint32_t GetWaveFormat(WaveFileInfo& wave) override;
-    virtual Source* GenSource(Source::LoadBuffer loadBuffer, size_t bufsize, int format, uint32_t freq) override;
+    virtual uint32_t GetFrequency() override;
+    virtual Source* GenSource(Source::LoadBuffer loadBuffer, Source::PeekBuffer peekBuffer, size_t bufsize, int format,
+                              uint32_t freq) override;
     virtual void DestroySource(Source* source) override;
 
     static std::pair<uint16_t, uint16_t> ExtractFormat(uint32_t format);
@@ -66,11 +75,21 @@ namespace tinyoal {
   private:
     ALuint* _alloc();
     void _dealloc(ALuint* buf);
+    void _loadExtensions();
+
+    struct MapBufferFuncs
+    {
+      LPALBUFFERSTORAGESOFT alBufferStorageSOFT;
+      LPALMAPBUFFERSOFT alMapBufferSOFT;
+      LPALUNMAPBUFFERSOFT alUnmapBufferSOFT;
+      LPALFLUSHMAPPEDBUFFERSOFT alFlushMappedBufferSOFT;
+    };
 
     const unsigned char defNumBuf;
     std::unique_ptr<OPENALFNTABLE> oalFuncs;
     std::unique_ptr<char[]> _dllpath;
     bun::BlockAlloc _bufalloc;
+    MapBufferFuncs _mapbuffer; // All NULL unless the current context supports AL_SOFT_map_buffer
   };
 }
 
@@ -7,16 +7,23 @@
 #include "tinyoal/TinyOAL.h"
 #include <ostream>
 
-#ifdef BUN_PLATFORM_WIN32
-  #include "win32_includes.h"
-
-  #define OGG_MODULE_ALT "vorbisfile.dll"
-  #define OGG_MODULE     "libvorbisfile.dll"
+#ifdef TINYOAL_STATIC_CODECS
+  #define OGG_MODULE       ""
+  #define LOADDYNLIB(s)    (void*)(~0)
+  #define GETDYNFUNC(p, s) (&s)
+  #define FREEDYNLIB(p)    ((void)0)
 #else
-  #include <dlfcn.h>
-  #define OGG_MODULE_ALT "vorbisfile.so.3"
-  #define OGG_MODULE32   "libvorbisfile.so.3"
-  #define OGG_MODULE     "libvorbisfile.so.3"
+  #ifdef BUN_PLATFORM_WIN32
+    #include "win32_includes.h"
+
+    #define OGG_MODULE_ALT "vorbisfile.dll"
+    #define OGG_MODULE     "libvorbisfile.dll"
+  #else
+    #include <dlfcn.h>
+    #define OGG_MODULE_ALT "vorbisfile.so.3"
+    #define OGG_MODULE32   "libvorbisfile.so.3"
+    #define OGG_MODULE     "libvorbisfile.so.3"
+  #endif
 #endif
 
 using namespace tinyoal;
@@ -34,18 +41,22 @@ OggFunctions::OggFunctions(const char* force)
   {
     fn_ov_clear          = (LPOVCLEAR)GETDYNFUNC(_oggDLL, ov_clear);
     fn_ov_read           = (LPOVREAD)GETDYNFUNC(_oggDLL, ov_read);
+    fn_ov_read_float     = (LPOVREADFLOAT)GETDYNFUNC(_oggDLL, ov_read_float);
     fn_ov_info           = (LPOVINFO)GETDYNFUNC(_oggDLL, ov_info);
     fn_ov_open_callbacks = (LPOVOPENCALLBACKS)GETDYNFUNC(_oggDLL, ov_open_callbacks);
     fn_ov_time_seek      = (LPOVTIMESEEK)GETDYNFUNC(_oggDLL, ov_time_seek);
     fn_ov_pcm_seek       = (LPOVPCMSEEK)GETDYNFUNC(_oggDLL, ov_pcm_seek);
+    fn_ov_raw_seek       = (LPOVRAWSEEK)GETDYNFUNC(_oggDLL, ov_raw_seek);
     fn_ov_pcm_tell       = (LPOVPCMTELL)GETDYNFUNC(_oggDLL, ov_pcm_tell);
     fn_ov_pcm_total      = (LPOVPCMTOTAL)GETDYNFUNC(_oggDLL, ov_pcm_total);
-    // fn_ov_comment = (LPOVCOMMENT)GETDYNFUNC(_oggDLL, ov_comment);
+    fn_ov_comment        = (LPOVCOMMENT)GETDYNFUNC(_oggDLL, ov_comment);
 
     if(!fn_ov_clear)
       TINYOAL_LOG(1, "Could not load ov_clear");
     if(!fn_ov_read)
       TINYOAL_LOG(1, "Could not load ov_read");
+    if(!fn_ov_read_float)
+      TINYOAL_LOG(2, "Could not load ov_read_float, float decoding will be unavailable");
     if(!fn_ov_info)
       TINYOAL_LOG(1, "Could not load ov_info");
     if(!fn_ov_open_callbacks)
@@ -54,11 +65,14 @@ OggFunctions::OggFunctions(const char* force)
       TINYOAL_LOG(1, "Could not load ov_time_seek");
     if(!fn_ov_pcm_seek)
       TINYOAL_LOG(1, "Could not load ov_pcm_seek");
+    if(!fn_ov_raw_seek)
+      TINYOAL_LOG(2, "Could not load ov_raw_seek, seeking will fall back to ov_pcm_seek");
     if(!fn_ov_pcm_tell)
       TINYOAL_LOG(1, "Could not load ov_pcm_tell");
     if(!fn_ov_pcm_total)
       TINYOAL_LOG(1, "Could not load ov_pcm_total");
-    // if(!fn_ov_comment) TINYOAL_LOG(1,"Could not load ov_comment");
+    if(!fn_ov_comment)
+      TINYOAL_LOG(2, "Could not load ov_comment, falling back to scanning for LOOPSTART manually");
   }
   else
     TINYOAL_LOG(1, "Could not find the OGG Vorbis DLL (or it may be missing one of its dependencies)");
@@ -111,6 +125,18 @@ ogg_int64_t OggFunctions::GetCommentSection(OggVorbis_File* vf)
 
 ogg_int64_t OggFunctions::GetLoopStart(OggVorbis_File* vf)
 {
+  if(fn_ov_comment) // ov_open has already parsed the comment header for us, so there's no need to read the file again
+  {
+    vorbis_comment* vc = fn_ov_comment(vf, -1);
+    for(int i = 0; vc != nullptr && i < vc->comments; ++i)
+    {
+      const char* comment = vc->user_comments[i];
+      if(vc->comment_lengths[i] > 10 && !STRNICMP(comment, "LOOPSTART=", 10))
+        return atol(comment + 10);
+    }
+    return -1;
+  }
+
   if(vf->seekable == 0)
     return -1; // if not seekable, fail
   long orig = vf->callbacks.tell_func(vf->datasource);
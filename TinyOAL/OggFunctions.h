@@ -12,14 +12,16 @@ namespace tinyoal {
   typedef int (*LPOVCLEAR)(OggVorbis_File* vf);
   typedef long (*LPOVREAD)(OggVorbis_File* vf, char* buffer, int length, int bigendianp, int word, int sgned,
                            int* bitstream);
+  typedef long (*LPOVREADFLOAT)(OggVorbis_File* vf, float*** pcm_channels, int samples, int* bitstream);
   typedef vorbis_info* (*LPOVINFO)(OggVorbis_File* vf, int link);
   typedef int (*LPOVOPENCALLBACKS)(void* datasource, OggVorbis_File* vf, char* initial, long ibytes,
                                    ov_callbacks callbacks);
   typedef int (*LPOVTIMESEEK)(OggVorbis_File* vf, double pos);
   typedef int (*LPOVPCMSEEK)(OggVorbis_File* vf, ogg_int64_t pos);
+  typedef int (*LPOVRAWSEEK)(OggVorbis_File* vf, ogg_int64_t pos);
   typedef ogg_int64_t (*LPOVPCMTELL)(OggVorbis_File* vf);
   typedef ogg_int64_t (*LPOVPCMTOTAL)(OggVorbis_File* vf, int i);
-  // typedef vorbis_comment * (*LPOVCOMMENT)(OggVorbis_File *vf,int link);
+  typedef vorbis_comment* (*LPOVCOMMENT)(OggVorbis_File* vf, int link);
 
   // This is a holder class for the OGG DLL specific functions
   class OggFunctions
@@ -31,15 +33,17 @@ namespace tinyoal {
 
     LPOVCLEAR fn_ov_clear;
     LPOVREAD fn_ov_read;
+    LPOVREADFLOAT fn_ov_read_float;
     LPOVINFO fn_ov_info;
     LPOVOPENCALLBACKS fn_ov_open_callbacks;
     LPOVTIMESEEK fn_ov_time_seek;
     LPOVPCMSEEK fn_ov_pcm_seek;
+    LPOVRAWSEEK fn_ov_raw_seek;
     LPOVPCMTELL fn_ov_pcm_tell;
     LPOVPCMTOTAL fn_ov_pcm_total;
-    // LPOVCOMMENT fn_ov_comment;
+    LPOVCOMMENT fn_ov_comment;
 
-    static ogg_int64_t GetLoopStart(OggVorbis_File* vf);
+    ogg_int64_t GetLoopStart(OggVorbis_File* vf); // Returns the LOOPSTART comment, or -1 if there isn't one
     static ogg_int64_t GetCommentSection(OggVorbis_File* vf);
     // static TINYOAL_DLLEXPORT bool WriteLoopStartToFile(const wchar_t* file, OggVorbis_File *vf, ogg_int64_t sample);
 
@@ -0,0 +1,72 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+
+#include "OpusFunctions.h"
+#include "tinyoal/TinyOAL.h"
+
+#ifdef TINYOAL_STATIC_CODECS
+  #define OPUS_MODULE      ""
+  #define LOADDYNLIB(s)    (void*)(~0)
+  #define GETDYNFUNC(p, s) (&s)
+  #define FREEDYNLIB(p)    ((void)0)
+#else
+  #ifdef BUN_PLATFORM_WIN32
+    #include "win32_includes.h"
+
+    #define OPUS_MODULE_ALT "opusfile.dll"
+    #define OPUS_MODULE     "libopusfile-0.dll"
+  #else
+    #include <dlfcn.h>
+    #define OPUS_MODULE_ALT "libopusfile.so"
+    #define OPUS_MODULE     "libopusfile.so.0"
+  #endif
+#endif
+
+#define DYNFUNC(v, t, n)          \
+  v = (t)GETDYNFUNC(_opusDLL, n); \
+  if(!v)                          \
+  TINYOAL_LOG(1, "Could not load " TXT(n))
+
+using namespace tinyoal;
+
+OpusFunctions::OpusFunctions(const char* force)
+{
+  if(!force)
+    force = OPUS_MODULE;
+  bun::bun_Fill(*this, 0);
+  _opusDLL = LOADDYNLIB(force);
+  if(!_opusDLL)
+    _opusDLL = LOADDYNLIB(OPUS_MODULE_ALT);
+
+  if(_opusDLL)
+  {
+    DYNFUNC(fn_op_open_callbacks, LPOPOPENCALLBACKS, op_open_callbacks);
+    DYNFUNC(fn_op_free, LPOPFREE, op_free);
+    DYNFUNC(fn_op_channel_count, LPOPCHANNELCOUNT, op_channel_count);
+    DYNFUNC(fn_op_pcm_total, LPOPPCMTOTAL, op_pcm_total);
+    DYNFUNC(fn_op_tags, LPOPTAGS, op_tags);
+    DYNFUNC(fn_op_pcm_seek, LPOPPCMSEEK, op_pcm_seek);
+    DYNFUNC(fn_op_pcm_tell, LPOPPCMTELL, op_pcm_tell);
+    DYNFUNC(fn_op_read, LPOPREAD, op_read);
+    DYNFUNC(fn_opus_tags_query, LPOPUSTAGSQUERY, opus_tags_query);
+    fn_op_read_float = (LPOPREADFLOAT)GETDYNFUNC(_opusDLL, op_read_float);
+    if(!fn_op_read_float)
+      TINYOAL_LOG(2, "Could not load op_read_float, float decoding will be unavailable");
+  }
+  else
+    TINYOAL_LOG(1, "Could not find the opusfile DLL (or it may be missing one of its dependencies)");
+}
+
+OpusFunctions::~OpusFunctions()
+{
+  if(_opusDLL)
+    FREEDYNLIB(_opusDLL);
+}
+
+ogg_int64_t OpusFunctions::GetLoopStart(OggOpusFile* of)
+{
+  const OpusTags* tags = !fn_op_tags ? nullptr : fn_op_tags(of, -1);
+  const char* loop     = (!tags || !fn_opus_tags_query) ? nullptr : fn_opus_tags_query(tags, "LOOPSTART", 0);
+  return !loop ? -1 : atol(loop);
+}
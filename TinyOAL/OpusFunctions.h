@@ -0,0 +1,50 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+// Notice: This header file does not need to be included in binary distributions of the library
+
+#ifndef TOAL__OPUS_FUNCTIONS_H
+#define TOAL__OPUS_FUNCTIONS_H
+
+#include "opus/opusfile.h"
+
+namespace tinyoal {
+  typedef OggOpusFile* (*LPOPOPENCALLBACKS)(void* stream, const OpusFileCallbacks* cb, const unsigned char* initial_data,
+                                            size_t initial_bytes, int* error);
+  typedef void (*LPOPFREE)(OggOpusFile* of);
+  typedef int (*LPOPCHANNELCOUNT)(const OggOpusFile* of, int li);
+  typedef ogg_int64_t (*LPOPPCMTOTAL)(const OggOpusFile* of, int li);
+  typedef const OpusTags* (*LPOPTAGS)(const OggOpusFile* of, int li);
+  typedef int (*LPOPPCMSEEK)(OggOpusFile* of, ogg_int64_t pcm_offset);
+  typedef ogg_int64_t (*LPOPPCMTELL)(const OggOpusFile* of);
+  typedef int (*LPOPREAD)(OggOpusFile* of, opus_int16* pcm, int buf_size, int* li);
+  typedef int (*LPOPREADFLOAT)(OggOpusFile* of, float* pcm, int buf_size, int* li);
+  typedef const char* (*LPOPUSTAGSQUERY)(const OpusTags* tags, const char* tag, int count);
+
+  // This is a holder class for the opusfile DLL specific functions
+  class OpusFunctions
+  {
+  public:
+    OpusFunctions(const char* force);
+    ~OpusFunctions();
+    inline bool Failure() { return _opusDLL == nullptr; }
+
+    LPOPOPENCALLBACKS fn_op_open_callbacks;
+    LPOPFREE fn_op_free;
+    LPOPCHANNELCOUNT fn_op_channel_count;
+    LPOPPCMTOTAL fn_op_pcm_total;
+    LPOPTAGS fn_op_tags;
+    LPOPPCMSEEK fn_op_pcm_seek;
+    LPOPPCMTELL fn_op_pcm_tell;
+    LPOPREAD fn_op_read;
+    LPOPREADFLOAT fn_op_read_float;
+    LPOPUSTAGSQUERY fn_opus_tags_query;
+
+    ogg_int64_t GetLoopStart(OggOpusFile* of); // Returns the LOOPSTART tag, or -1 if there isn't one
+
+  protected:
+    void* _opusDLL;
+  };
+}
+
+#endif
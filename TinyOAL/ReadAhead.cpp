@@ -0,0 +1,322 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+
+#include "ReadAhead.h"
+#include "tinyoal/AudioResource.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#ifdef __linux__
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <sys/uio.h>
+  #include <unistd.h>
+  #include <errno.h>
+  #include <string.h>
+#endif
+
+using namespace tinyoal;
+
+namespace {
+  enum READAHEAD_STATE : uint8_t
+  {
+    READAHEAD_QUEUED = 0,
+    READAHEAD_READING,
+    READAHEAD_DONE,
+  };
+
+  // Blocks that follow each other in the same file, which are read with a single call
+  struct Run
+  {
+    ReadAheadBlock** blocks;
+    size_t count;
+    int64_t got; // Negative until the run has been read, or if reading it failed
+  };
+
+  // Heap order that puts the earliest deadline on top
+  bool later(const ReadAheadBlock* l, const ReadAheadBlock* r) { return l->deadline > r->deadline; }
+
+  // Sorts the batch by where the blocks are and merges any that touch into runs, returning how many runs there are
+  size_t group(ReadAheadBlock** batch, size_t count, Run* runs)
+  {
+    std::sort(batch, batch + count, [](const ReadAheadBlock* l, const ReadAheadBlock* r) {
+      return (l->file != r->file) ? std::less<FILE*>()(l->file, r->file) : (l->offset < r->offset);
+    });
+
+    size_t n = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+      const ReadAheadBlock* last = !n ? nullptr : runs[n - 1].blocks[runs[n - 1].count - 1];
+      if(last && last->file == batch[i]->file && last->offset + last->len == batch[i]->offset)
+        ++runs[n - 1].count;
+      else
+        runs[n++] = { batch + i, 1, -1 };
+    }
+    return n;
+  }
+
+  // Splits what each run got between its blocks, reading any run that failed one block at a time instead
+  void finish(Run* runs, size_t count)
+  {
+    for(size_t i = 0; i < count; ++i)
+    {
+      int64_t left = runs[i].got;
+      for(size_t j = 0; j < runs[i].count; ++j)
+      {
+        ReadAheadBlock* block = runs[i].blocks[j];
+        if(runs[i].got < 0)
+          block->got = (uint32_t)file_pread(block->file, block->data, block->len, block->offset);
+        else
+        {
+          block->got = (uint32_t)std::min<int64_t>(left, block->len);
+          left -= block->got;
+        }
+      }
+    }
+  }
+
+#ifdef __linux__
+  // Just enough of io_uring to hand the kernel a batch of reads and wait for all of them, without depending on liburing
+  struct Ring
+  {
+    bool Init(unsigned entries)
+    {
+      io_uring_params p = {};
+      if((fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return false;
+
+      sqsize  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cqsize  = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      sqesize = p.sq_entries * sizeof(io_uring_sqe);
+      single  = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if(single)
+        sqsize = cqsize = std::max(sqsize, cqsize);
+
+      sq   = (char*)mmap(nullptr, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      cq   = single ? sq : (char*)mmap(nullptr, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                       IORING_OFF_CQ_RING);
+      sqes = (io_uring_sqe*)mmap(nullptr, sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                 IORING_OFF_SQES);
+      if(sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+      {
+        Destroy();
+        return false;
+      }
+
+      sqhead  = (unsigned*)(sq + p.sq_off.head);
+      sqtail  = (unsigned*)(sq + p.sq_off.tail);
+      sqmask  = *(unsigned*)(sq + p.sq_off.ring_mask);
+      sqarray = (unsigned*)(sq + p.sq_off.array);
+      cqhead  = (unsigned*)(cq + p.cq_off.head);
+      cqtail  = (unsigned*)(cq + p.cq_off.tail);
+      cqmask  = *(unsigned*)(cq + p.cq_off.ring_mask);
+      cqes    = (io_uring_cqe*)(cq + p.cq_off.cqes);
+      return true;
+    }
+    void Destroy()
+    {
+      if(sqes && sqes != MAP_FAILED)
+        munmap(sqes, sqesize);
+      if(cq && cq != MAP_FAILED && !single)
+        munmap(cq, cqsize);
+      if(sq && sq != MAP_FAILED)
+        munmap(sq, sqsize);
+      if(fd >= 0)
+        close(fd);
+      sq   = cq = nullptr;
+      sqes = nullptr;
+      fd   = -1;
+    }
+    // Submits one vectored read per run with a single system call and waits for every one of them to come back. Returns
+    // false if the ring stops working, but only once every read the kernel already took has come back, because those keep
+    // writing into the blocks until they do. Runs the kernel never took are left with got < 0.
+    bool Read(Run* runs, size_t count)
+    {
+      iovec iov[ReadAhead::BATCH];
+      size_t k       = 0;
+      unsigned tail  = *sqtail; // Only this thread ever moves the tail
+      unsigned first = tail;    // The ring is empty between batches, so the head is here too
+      for(size_t i = 0; i < count; ++i)
+      {
+        for(size_t j = 0; j < runs[i].count; ++j)
+          iov[k + j] = { runs[i].blocks[j]->data, runs[i].blocks[j]->len };
+
+        unsigned index    = tail++ & sqmask;
+        io_uring_sqe* sqe = sqes + index;
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode    = IORING_OP_READV;
+        sqe->fd        = fileno(runs[i].blocks[0]->file);
+        sqe->off       = runs[i].blocks[0]->offset;
+        sqe->addr      = (uint64_t)(uintptr_t)(iov + k);
+        sqe->len       = (uint32_t)runs[i].count;
+        sqe->user_data = i;
+        sqarray[index] = index;
+        k += runs[i].count;
+      }
+      __atomic_store_n(sqtail, tail, __ATOMIC_RELEASE);
+
+      size_t reaped = 0;
+      bool ok       = true;
+      while(reaped < count)
+      {
+        size_t taken = __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) - first; // Reads the kernel has taken off the ring
+        if(!ok && reaped >= taken)
+          break;
+        int r = (int)syscall(__NR_io_uring_enter, fd, ok ? (unsigned)(count - taken) : 0u,
+                             (unsigned)((ok ? count : taken) - reaped), IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        { // Stop submitting. If we can't even wait, the kernel still posts completions to the ring, so check back later.
+          if(!ok)
+            usleep(1000);
+          ok = false;
+        }
+
+        unsigned head = *cqhead;
+        for(unsigned end = __atomic_load_n(cqtail, __ATOMIC_ACQUIRE); head != end; ++head, ++reaped)
+        {
+          const io_uring_cqe* cqe = cqes + (head & cqmask);
+          runs[cqe->user_data].got = cqe->res;
+        }
+        __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+      }
+      return ok;
+    }
+
+    int fd = -1;
+    bool single;
+    char* sq = nullptr;
+    char* cq = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqsize;
+    size_t cqsize;
+    size_t sqesize;
+    unsigned* sqhead;
+    unsigned* sqtail;
+    unsigned sqmask;
+    unsigned* sqarray;
+    unsigned* cqhead;
+    unsigned* cqtail;
+    unsigned cqmask;
+    io_uring_cqe* cqes;
+  };
+#endif
+}
+
+ReadAhead::ReadAhead() : _deadline(0), _quit(false) {}
+ReadAhead::~ReadAhead()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _quit = true;
+  }
+  _wake.notify_one();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+void ReadAhead::Submit(ReadAheadBlock* block)
+{
+  block->deadline = GetDeadline();
+  block->pending  = true;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if(!_thread.joinable())
+      _thread = std::thread(&ReadAhead::_run, this);
+    block->state = READAHEAD_QUEUED;
+    _queue.push_back(block);
+    std::push_heap(_queue.begin(), _queue.end(), &later);
+  }
+  _wake.notify_one();
+}
+
+uint32_t ReadAhead::Wait(ReadAheadBlock* block)
+{
+  if(!block->pending)
+    return 0;
+  block->pending = false;
+
+  std::unique_lock<std::mutex> lock(_lock);
+  if(block->state == READAHEAD_QUEUED)
+  {
+    _take(block);
+    lock.unlock();
+    return block->got = (uint32_t)file_pread(block->file, block->data, block->len, block->offset);
+  }
+  _done.wait(lock, [block] { return block->state == READAHEAD_DONE; });
+  return block->got;
+}
+
+void ReadAhead::Cancel(ReadAheadBlock* block)
+{
+  if(!block->pending)
+    return;
+  block->pending = false;
+
+  std::unique_lock<std::mutex> lock(_lock);
+  if(block->state == READAHEAD_QUEUED)
+    _take(block);
+  else
+    _done.wait(lock, [block] { return block->state == READAHEAD_DONE; });
+}
+
+uint64_t ReadAhead::Now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+void ReadAhead::_take(ReadAheadBlock* block)
+{
+  _queue.erase(std::find(_queue.begin(), _queue.end(), block));
+  std::make_heap(_queue.begin(), _queue.end(), &later);
+}
+
+void ReadAhead::_run()
+{
+#ifdef __linux__
+  Ring ring;
+  Ring* uring = ring.Init(BATCH) ? &ring : nullptr; // Kernels before 5.1, or sandboxes that block io_uring, use pread
+#endif
+  ReadAheadBlock* batch[BATCH];
+  Run runs[BATCH];
+
+  std::unique_lock<std::mutex> lock(_lock);
+  for(;;)
+  {
+    _wake.wait(lock, [this] { return _quit || !_queue.empty(); });
+    if(_quit)
+      break;
+
+    size_t count = 0;
+    for(; count < BATCH && !_queue.empty(); ++count)
+    {
+      std::pop_heap(_queue.begin(), _queue.end(), &later);
+      batch[count]        = _queue.back();
+      batch[count]->state = READAHEAD_READING;
+      _queue.pop_back();
+    }
+    lock.unlock();
+
+    size_t n = group(batch, count, runs);
+#ifdef __linux__
+    if(uring && !uring->Read(runs, n))
+    { // Whatever went wrong will probably go wrong again, so give up on the ring. Nothing it took is still in flight, and
+      // the runs it never took are read below.
+      uring->Destroy();
+      uring = nullptr;
+    }
+#endif
+    finish(runs, n);
+
+    lock.lock();
+    for(size_t i = 0; i < count; ++i)
+      batch[i]->state = READAHEAD_DONE;
+    _done.notify_all();
+  }
+
+#ifdef __linux__
+  ring.Destroy();
+#endif
+}
@@ -0,0 +1,70 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+// Notice: This header file does not need to be included in binary distributions of the library
+
+#ifndef TOAL__READ_AHEAD_H
+#define TOAL__READ_AHEAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace tinyoal {
+  // Part of a file that a FileStream wants read before it gets there. Everything but data is set by the owner before it
+  // submits the block, and nothing but data and got are touched by the read-ahead thread until the owner waits on it.
+  struct ReadAheadBlock
+  {
+    FILE* file;
+    char* data;      // Swapped with the stream's buffer once the stream gets to it
+    uint64_t offset; // Absolute position in the file
+    uint32_t len;
+    uint32_t got; // How much was actually read, once the block is done
+    uint64_t deadline;
+    uint8_t state; // Guarded by the queue lock
+    bool pending;  // Submitted and not yet waited on or cancelled. Only the owner touches this.
+  };
+
+  // Reads blocks of files on a background thread, so a cold page cache or a slow disk stalls that thread instead of
+  // TinyOAL::Update. The blocks with the earliest deadlines are taken a batch at a time, and blocks that follow each other
+  // in the same file are read with a single call. On Linux each batch is handed to io_uring so the disk sees all of it at
+  // once, otherwise the thread falls back to reading one block at a time with file_pread.
+  class ReadAhead
+  {
+  public:
+    ReadAhead();
+    ~ReadAhead();
+    // Queues a block that isn't pending, starting the thread the first time this is called
+    void Submit(ReadAheadBlock* block);
+    // Returns how many bytes were read into a pending block, waiting for them if we have to. If the thread hasn't gotten to
+    // the block yet, it's read right here instead, because the caller needs it now.
+    uint32_t Wait(ReadAheadBlock* block);
+    // Takes a pending block back off the queue, or waits for the thread to finish with it
+    void Cancel(ReadAheadBlock* block);
+    // The engine sets this to when a voice's queued buffers run out before refilling them, so whatever gets read ahead
+    // during the refill is ordered by how soon that voice would starve. 0 means now.
+    inline void SetDeadline(uint64_t deadline) { _deadline = deadline; }
+    inline uint64_t GetDeadline() const { return !_deadline ? Now() : _deadline; }
+    // Microseconds on a clock that never goes backwards
+    static uint64_t Now();
+
+    static const size_t BATCH = 16; // Most blocks read at once
+
+  protected:
+    void _run();
+    void _take(ReadAheadBlock* block);
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _wake;       // Signaled when a block is queued or the thread has to quit
+    std::condition_variable _done;       // Signaled when a batch is finished
+    std::vector<ReadAheadBlock*> _queue; // Heap with the earliest deadline on top
+    uint64_t _deadline;
+    bool _quit;
+  };
+}
+
+#endif
@@ -0,0 +1,82 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+
+#include "SeekIndex.h"
+#include "tinyoal/TinyOAL.h"
+
+using namespace tinyoal;
+
+void SeekIndex::Request()
+{
+  if(_requested)
+    return;
+  _requested = true;
+  if(TinyOAL::Instance() && TinyOAL::Instance()->GetSeekIndexer())
+    TinyOAL::Instance()->GetSeekIndexer()->Submit(this);
+}
+
+void SeekIndex::Stop()
+{
+  if(_requested && TinyOAL::Instance() && TinyOAL::Instance()->GetSeekIndexer())
+    TinyOAL::Instance()->GetSeekIndexer()->Cancel(this);
+}
+
+SeekIndexer::SeekIndexer() : _building(nullptr), _quit(false) {}
+SeekIndexer::~SeekIndexer()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _quit = true;
+  }
+  _wake.notify_one();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+void SeekIndexer::Submit(SeekIndex* index)
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if(!_thread.joinable())
+      _thread = std::thread(&SeekIndexer::_run, this);
+    _queue.push_back(index);
+  }
+  _wake.notify_one();
+}
+
+void SeekIndexer::Cancel(SeekIndex* index)
+{
+  std::unique_lock<std::mutex> lock(_lock);
+  auto i = std::find(_queue.begin(), _queue.end(), index);
+  if(i != _queue.end())
+    _queue.erase(i);
+  else if(_building == index)
+  {
+    index->_cancel.store(true, std::memory_order_relaxed);
+    _done.wait(lock, [this, index] { return _building != index; });
+  }
+}
+
+void SeekIndexer::_run()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+  for(;;)
+  {
+    _wake.wait(lock, [this] { return _quit || !_queue.empty(); });
+    if(_quit)
+      break;
+
+    SeekIndex* index = _building = _queue.front();
+    _queue.pop_front();
+    lock.unlock();
+
+    index->_build(index->_owner, index->points, index->_cancel);
+    if(!index->_cancel.load(std::memory_order_relaxed))
+      index->_ready.store(true, std::memory_order_release);
+
+    lock.lock();
+    _building = nullptr;
+    _done.notify_all();
+  }
+}
@@ -0,0 +1,88 @@
+// Copyright (c)2020 Erik McClure
+// This file is part of TinyOAL - An OpenAL Audio engine
+// For conditions of distribution and use, see copyright notice in TinyOAL.h
+// Notice: This header file does not need to be included in binary distributions of the library
+
+#ifndef TOAL__SEEK_INDEX_H
+#define TOAL__SEEK_INDEX_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace tinyoal {
+  // Sorted table of sample positions and the byte offsets they can be decoded from, so a seek can jump straight to the
+  // right spot instead of searching the stream for it. A resource requests this the first time one of its streams seeks,
+  // the SeekIndexer builds it, and every stream shares it. Until it's ready, streams have to seek the slow way.
+  struct SeekIndex
+  {
+    struct Point
+    {
+      uint64_t sample;
+      uint64_t offset;
+    };
+
+    // Fills points from the owner's data, giving up whenever cancel gets set. This runs on the indexer thread.
+    typedef void (*BUILDER)(void* owner, std::vector<Point>& points, const std::atomic<bool>& cancel);
+
+    SeekIndex(BUILDER build, void* owner) : _build(build), _owner(owner), _requested(false) {}
+    ~SeekIndex() { Stop(); }
+    // Queues the build the first time this is called, and does nothing after that. Only call this from the thread that
+    // owns the resource.
+    void Request();
+    // Takes the build off the queue, or cancels it and waits for it, which has to happen before anything it reads goes
+    // away
+    void Stop();
+    // Returns the last point at or before sample, or NULL if sample comes before every point or the index isn't ready
+    inline const Point* Find(uint64_t sample) const
+    {
+      if(!_ready.load(std::memory_order_acquire))
+        return nullptr;
+      auto i = std::upper_bound(points.begin(), points.end(), sample,
+                                [](uint64_t s, const Point& p) { return s < p.sample; });
+      return (i == points.begin()) ? nullptr : &*(i - 1);
+    }
+
+    std::vector<Point> points; // Belongs to the build until it's ready, and never changes after that
+
+  protected:
+    friend class SeekIndexer;
+
+    BUILDER _build;
+    void* _owner;
+    bool _requested;
+    std::atomic<bool> _ready  = false; // Never set if the build was cancelled
+    std::atomic<bool> _cancel = false;
+  };
+
+  // Builds seek indexes one at a time on a single background thread, in the order they were requested, so loading a lot
+  // of resources doesn't start a lot of threads and resources that never seek never build anything.
+  class SeekIndexer
+  {
+  public:
+    SeekIndexer();
+    ~SeekIndexer();
+    // Queues an index, starting the thread the first time this is called
+    void Submit(SeekIndex* index);
+    // Takes an index back off the queue, or cancels its build and waits for it if it already started
+    void Cancel(SeekIndex* index);
+
+  protected:
+    void _run();
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _wake; // Signaled when an index is queued or the thread has to quit
+    std::condition_variable _done; // Signaled when a build finishes
+    std::deque<SeekIndex*> _queue;
+    SeekIndex* _building; // Guarded by the lock
+    bool _quit;
+  };
+}
+
+#endif
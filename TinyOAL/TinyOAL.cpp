@@ -9,11 +9,16 @@
 #include "AudioResourceOGG.h"
 #include "AudioResourceMP3.h"
 #include "AudioResourceFLAC.h"
+#include "AudioResourceOPUS.h"
 #include "tinyoal/Audio.h"
 #include "OggFunctions.h"
 #include "Mp3Functions.h"
 #include "WaveFunctions.h"
 #include "FlacFunctions.h"
+#include "OpusFunctions.h"
+#include "Kernels.h"
+#include "ReadAhead.h"
+#include "SeekIndex.h"
 #include <fstream>
 #include <memory>
 #include <stdio.h>
@@ -46,11 +51,13 @@ TinyOAL* TinyOAL::_instance           = nullptr;
 const bun_VersionInfo TinyOAL::Version = { 0, TINYOAL_VERSION_REVISION, TINYOAL_VERSION_MINOR, TINYOAL_VERSION_MAJOR };
 
 TinyOAL::TinyOAL(enum ENGINE_TYPE type, FNLOG fnLog, unsigned char defnumbuf, const char* forceOAL, const char* forceOGG,
-                 const char* forceFLAC,
-                 const char* forceMP3) :
+                 const char* forceFLAC, const char* forceMP3, const char* forceOPUS) :
   _reslist(nullptr),
   _activereslist(nullptr),
   _fnLog((!fnLog) ? (&DefaultLog) : fnLog),
+  _floatdecode(false),
+  _prefixms(0),
+  _loopms(0),
   _allocaudio(5),
   _codecs(AudioResource::TINYOAL_FILETYPE_CUSTOM - 1),
   _audiohash(4)
@@ -63,7 +70,9 @@ TinyOAL::TinyOAL(enum ENGINE_TYPE type, FNLOG fnLog, unsigned char defnumbuf, co
   case ENGINE_WASAPI_EXCLUSIVE: _engine.reset(new WASEngine(true)); break;
   }
   _engine->Init();
-  _construct(forceOGG, forceFLAC, forceMP3);
+  _readahead.reset(new ReadAhead());     // The thread doesn't start until something reads ahead
+  _seekindexer.reset(new SeekIndexer()); // Nor does this one until something seeks
+  _construct(forceOGG, forceFLAC, forceMP3, forceOPUS);
 }
 
 TinyOAL::~TinyOAL()
@@ -73,12 +82,15 @@ TinyOAL::~TinyOAL()
     delete _activereslist;
   while(_reslist)
     delete _reslist;
+  _readahead.reset();   // Every stream is closed by now, so nothing is waiting on the thread
+  _seekindexer.reset(); // Every resource cancelled its index when it was destroyed
 
   // Ensure all destructors are called before TinyOAL deletes it's instance pointer
   _waveFuncs.reset();
   _oggFuncs.reset();
   _mp3Funcs.reset();
   _flacFuncs.reset();
+  _opusFuncs.reset();
   _engine.reset();
 
   if(_instance == this)
@@ -147,13 +159,22 @@ Engine* TinyOAL::GetEngine() { return _engine.get(); }
 const char* TinyOAL::GetDevices() { return 0; }
 size_t TinyOAL::GetDefaultDevice(char* out, size_t len) { return _engine->GetDefaultDevice(out, len); }
 bool TinyOAL::SetDevice(const char* device) { return _engine->SetDevice(device) == 0; }
+bool TinyOAL::SetFloatDecode(bool enable)
+{
+  _floatdecode = enable && _engine->GetType() == ENGINE_OPENAL;
+  if(enable && !_floatdecode)
+    TINYOAL_LOG(2, "Float decoding is only supported by the OpenAL engine, ignoring");
+  return _floatdecode == enable;
+}
+const char* TinyOAL::GetMp3Decoder() const { return !_mp3Funcs ? nullptr : _mp3Funcs->GetCurrentDecoder(); }
 
-void TinyOAL::_construct(const char* forceOGG, const char* forceFLAC, const char* forceMP3)
+void TinyOAL::_construct(const char* forceOGG, const char* forceFLAC, const char* forceMP3, const char* forceOPUS)
 {
   _waveFuncs.reset(new WaveFunctions());
   _oggFuncs.reset(new OggFunctions(forceOGG));
   _flacFuncs.reset(new FlacFunctions(forceFLAC));
   _mp3Funcs.reset(new Mp3Functions(forceMP3));
+  _opusFuncs.reset(new OpusFunctions(forceOPUS));
 
   if(_oggFuncs->Failure())
     _oggFuncs.reset();
@@ -161,6 +182,10 @@ void TinyOAL::_construct(const char* forceOGG, const char* forceFLAC, const char
     _flacFuncs.reset();
   if(_mp3Funcs->Failure())
     _mp3Funcs.reset();
+  if(_opusFuncs->Failure())
+    _opusFuncs.reset();
+
+  LOG(4, "Using %s sample conversion kernels", Kernels::Get().name);
 
   RegisterCodec(AudioResource::TINYOAL_FILETYPE_WAV, AudioResourceWAV::Construct, AudioResourceWAV::ScanHeader,
                 AudioResourceWAV::ToWave);
@@ -170,6 +195,8 @@ void TinyOAL::_construct(const char* forceOGG, const char* forceFLAC, const char
                 AudioResourceMP3::ToWave);
   RegisterCodec(AudioResource::TINYOAL_FILETYPE_FLAC, AudioResourceFLAC::Construct, AudioResourceFLAC::ScanHeader,
                 AudioResourceFLAC::ToWave);
+  RegisterCodec(AudioResource::TINYOAL_FILETYPE_OPUS, AudioResourceOPUS::Construct, AudioResourceOPUS::ScanHeader,
+                AudioResourceOPUS::ToWave);
 }
 
 void TinyOAL::_addAudio(Audio* ref, AudioResource* res)
@@ -281,8 +308,15 @@ void TinyOAL::RegisterCodec(unsigned char filetype, CODEC_CONSTRUCT construct, C
 TinyOAL::Codec* TinyOAL::GetCodec(unsigned char filetype) { return _codecs.Get(filetype); }
 
 // This function does NOT check to see if fileheader is 8 characters long
-unsigned char TinyOAL::_getFiletype(const char* fileheader)
+unsigned char TinyOAL::_getFiletype(const char* fileheader, size_t len)
 {
+  char padded[36] = { 0 };
+  if(len < sizeof(padded))
+  {
+    memcpy(padded, fileheader, len);
+    fileheader = padded;
+  }
+
   for(auto [k, v] : _codecs)
   {
     if(v.scanheader(fileheader))
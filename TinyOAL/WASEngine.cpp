@@ -4,6 +4,7 @@
 
 #include "WASEngine.h"
 #include "WaveFunctions.h"
+#include "ReadAhead.h"
 
 #ifdef BUN_PLATFORM_WIN32
 
@@ -79,10 +80,26 @@ uint32_t WASEngine::GetFormat(uint16_t channels, uint16_t bits, bool rear)
 uint32_t WASEngine::GetWaveFormat(WaveFileInfo& wave)
 {
   uint16_t bits = wave.wfEXT.Format.wBitsPerSample;
-  return GetFormat(wave.wfEXT.Format.nChannels, bits, wave.wfEXT.dwChannelMask == (SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT));
+  return GetFormat(wave.wfEXT.Format.nChannels, (bits == 24) ? 32 : bits, // 24-bit gets converted to 32 bit
+                   wave.wfEXT.dwChannelMask == (SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT));
 }
-Source* WASEngine::GenSource(Source::LoadBuffer loadBuffer, size_t bufsize, int format, uint32_t freq)
+uint32_t WASEngine::GetFrequency()
 {
+  IAudioClient* pClient = nullptr;
+  if(!_device || FAILED(_device->Activate(IID_IAudioClient, CLSCTX_ALL, NULL, (void**)&pClient)))
+    return 0;
+  std::unique_ptr<IAudioClient, IUnknownDeleter> client(pClient);
+
+  WAVEFORMATEX* mixformat;
+  if(FAILED(client->GetMixFormat(&mixformat)))
+    return 0;
+  uint32_t freq = mixformat->nSamplesPerSec;
+  CoTaskMemFree(mixformat);
+  return freq;
+}
+Source* WASEngine::GenSource(Source::LoadBuffer loadBuffer, Source::PeekBuffer peekBuffer, size_t bufsize, int format,
+                             uint32_t freq)
+{ // We decode straight into the buffer WASAPI hands us, so there's no extra copy for peekBuffer to save
   return new WASSource(_device.get(), loadBuffer, _exclusive, format, freq);
 }
 void WASEngine::DestroySource(Source* source) { delete source; }
@@ -192,9 +209,16 @@ bool WASEngine::WASSource::Update(void* context, bool isPlaying)
   if(FAILED(render->GetBuffer(numFramesAvailable, &buffer)))
     return false;
 
+  // Anything the stream reads ahead has to arrive before the frames still waiting in the device buffer run out
+  ReadAhead* readahead = TinyOAL::Instance()->GetReadAhead();
+  if(readahead && _format->nSamplesPerSec)
+    readahead->SetDeadline(ReadAhead::Now() + (numFramesPadding * 1000000ULL) / _format->nSamplesPerSec);
+
   // Get next 1/2-second of data from the audio source.
   const auto framebytes = _frameBytes();
   auto numFramesWritten    = (*_loadBuffer)(numFramesAvailable * framebytes, (char*)buffer, context) / framebytes;
+  if(readahead)
+    readahead->SetDeadline(0);
 
   if(FAILED(render->ReleaseBuffer(numFramesWritten, 0)))
     return false;
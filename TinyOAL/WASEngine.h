@@ -70,7 +70,9 @@ namespace tinyoal {
     virtual size_t GetDefaultDevice(char* out, size_t len) override;
     virtual uint32_t GetFormat(uint16_t channels, uint16_t bits, bool rear) override;
     virtual uint32_t GetWaveFormat(WaveFileInfo& wave) override;
-    virtual Source* GenSource(Source::LoadBuffer loadBuffer, size_t bufsize, int format, uint32_t freq) override;
+    virtual uint32_t GetFrequency() override;
+    virtual Source* GenSource(Source::LoadBuffer loadBuffer, Source::PeekBuffer peekBuffer, size_t bufsize, int format,
+                              uint32_t freq) override;
     virtual void DestroySource(Source* source) override;
 
     std::unique_ptr<IMMDeviceEnumerator, IUnknownDeleter> _enumerator;
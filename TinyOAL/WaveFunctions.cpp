@@ -23,8 +23,10 @@
  */
 
 #include "WaveFunctions.h"
-#include "buntils/sseVec.h"
+#include "Kernels.h"
 #include <string.h> //STRNICMP
+#include <algorithm>
+#include <math.h>
 #include "tinyoal/TinyOAL.h"
 
 using namespace tinyoal;
@@ -43,8 +45,32 @@ struct RIFFCHUNK
   char name[4];
   uint32_t size;
 };
+
+struct W64CHUNK
+{
+  uint8_t guid[16];
+  uint64_t size; // Unlike RIFF, this includes the chunk header
+};
+
+struct IMAADPCMFORMAT
+{
+  uint16_t wFormatTag;
+  uint16_t nChannels;
+  uint32_t nSamplesPerSec;
+  uint32_t nAvgBytesPerSec;
+  uint16_t nBlockAlign;
+  uint16_t wBitsPerSample;
+  uint16_t cbSize;
+  uint16_t wSamplesPerBlock;
+};
 #pragma pack(pop)
 
+// Sony Wave64 swaps every fourcc for a GUID. Chunk GUIDs start with the fourcc and end in W64_SUFFIX, except for the
+// riff GUID that starts the file.
+static const uint8_t W64_RIFF[16]   = { 'r',  'i',  'f',  'f',  0x2E, 0x91, 0xCF, 0x11,
+                                        0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 };
+static const uint8_t W64_SUFFIX[12] = { 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+
 WaveFunctions::WaveFunctions() {}
 
 WaveFunctions::WAVERESULT WaveFunctions::Open(void* source, WAVEFILEINFO* wave, wav_callbacks& callbacks)
@@ -59,24 +85,54 @@ WaveFunctions::WAVERESULT WaveFunctions::Open(void* source, WAVEFILEINFO* wave,
 
   WAVEFILEHEADER header;
   RIFFCHUNK chunk;
-  callbacks.read_func(&header, 1, sizeof(WAVEFILEHEADER), source);
-  if(STRNICMP(header.RIFF, "RIFF", 4) != 0 || STRNICMP(header.WAVE, "WAVE", 4) != 0)
+  if(callbacks.read_func(&header, 1, sizeof(WAVEFILEHEADER), source) != sizeof(WAVEFILEHEADER))
+    return WR_BADWAVEFILE;
+  if(!memcmp(&header, W64_RIFF, sizeof(WAVEFILEHEADER)))
+    return _openw64(*wave);
+
+  // RF64 and BW64 are RIFF with the sizes that don't fit in 32 bits set to 0xFFFFFFFF and moved into a ds64 chunk
+  bool rf64 = !STRNICMP(header.RIFF, "RF64", 4) || !STRNICMP(header.RIFF, "BW64", 4);
+  if((!rf64 && STRNICMP(header.RIFF, "RIFF", 4) != 0) || STRNICMP(header.WAVE, "WAVE", 4) != 0)
     return WR_BADWAVEFILE;
 
+  uint64_t datasize = 0;
   while(callbacks.read_func(&chunk, 1, sizeof(RIFFCHUNK), source) == sizeof(RIFFCHUNK))
   {
-    if(!STRNICMP(chunk.name, "fmt ", 4) && chunk.size <= sizeof(WAVEFORMATEXTENSIBLE)) // This is the format chunk
+    uint64_t size = chunk.size;
+    if(rf64 && !STRNICMP(chunk.name, "ds64", 4) && size >= sizeof(uint64_t) * 2)
+    {
+      uint64_t sizes[2]; // RIFF size, then data size
+      callbacks.read_func(sizes, 1, sizeof(sizes), source);
+      datasize = sizes[1];
+      callbacks.seek_func(source, size - sizeof(sizes), SEEK_CUR);
+    }
+    else if(!STRNICMP(chunk.name, "fmt ", 4) && size <= sizeof(WAVEFORMATEXTENSIBLE)) // This is the format chunk
       callbacks.read_func(&wave->wfEXT, 1, chunk.size, source);
+    else if(!STRNICMP(chunk.name, "fact", 4) && size >= sizeof(uint32_t))
+    {
+      uint32_t frames = 0;
+      callbacks.read_func(&frames, 1, sizeof(uint32_t), source);
+      wave->frames = (frames != 0xFFFFFFFF) ? frames : 0; // RF64 moves a count that doesn't fit into ds64, we don't need it
+      callbacks.seek_func(source, size - sizeof(uint32_t), SEEK_CUR);
+    }
     else if(!STRNICMP(chunk.name, "data", 4))
     { // This is the data chunk
       wave->offset = callbacks.tell_func(source);
-      wave->size   = chunk.size;
-      callbacks.seek_func(source, chunk.size, SEEK_CUR);
+      if(size == 0xFFFFFFFF && datasize > 0)
+        size = datasize;
+      else if(size == 0xFFFFFFFF) // No ds64 size, so the data is whatever is left of the stream
+      {
+        callbacks.seek_func(source, 0, SEEK_END);
+        wave->size = callbacks.tell_func(source) - wave->offset;
+        break;
+      }
+      wave->size = size;
+      callbacks.seek_func(source, size, SEEK_CUR);
     }
     else // Otherwise it's an unknown chunk so just skip it
-      callbacks.seek_func(source, chunk.size, SEEK_CUR);
+      callbacks.seek_func(source, size, SEEK_CUR);
 
-    if(chunk.size & 1)                          // Ensure we are aligned on an even byte boundary
+    if(size & 1)                                // Ensure we are aligned on an even byte boundary
       callbacks.seek_func(source, 1, SEEK_CUR); // If we're on an odd byte, bump the pointer forward one byte.
   }
 
@@ -85,73 +141,480 @@ WaveFunctions::WAVERESULT WaveFunctions::Open(void* source, WAVEFILEINFO* wave,
     return WR_BADWAVEFILE;
   return WR_OK;
 }
+WaveFunctions::WAVERESULT WaveFunctions::_openw64(WAVEFILEINFO& wave)
+{
+  uint8_t rest[28]; // The end of the riff GUID, the 64-bit file size, and the wave GUID
+  if(wave.callbacks.read_func(rest, 1, sizeof(rest), wave.source) != sizeof(rest) || memcmp(rest, W64_RIFF + 12, 4) ||
+     memcmp(rest + 12, "wave", 4) || memcmp(rest + 16, W64_SUFFIX, sizeof(W64_SUFFIX)))
+    return WR_BADWAVEFILE;
+
+  W64CHUNK chunk;
+  while(wave.callbacks.read_func(&chunk, 1, sizeof(W64CHUNK), wave.source) == sizeof(W64CHUNK))
+  {
+    if(chunk.size < sizeof(W64CHUNK))
+      return WR_BADWAVEFILE;
+    uint64_t size = chunk.size - sizeof(W64CHUNK);
+    bool known    = !memcmp(chunk.guid + 4, W64_SUFFIX, sizeof(W64_SUFFIX));
+    if(known && !memcmp(chunk.guid, "fmt ", 4) && size <= sizeof(WAVEFORMATEXTENSIBLE))
+      wave.callbacks.read_func(&wave.wfEXT, 1, (size_t)size, wave.source);
+    else if(known && !memcmp(chunk.guid, "data", 4))
+    {
+      wave.offset = wave.callbacks.tell_func(wave.source);
+      wave.size   = size;
+      wave.callbacks.seek_func(wave.source, size, SEEK_CUR);
+    }
+    else
+      wave.callbacks.seek_func(wave.source, size, SEEK_CUR);
+
+    if(chunk.size & 7) // Chunks are aligned to 8 bytes
+      wave.callbacks.seek_func(wave.source, 8 - (chunk.size & 7), SEEK_CUR);
+  }
+
+  if(!wave.offset || !wave.size)
+    return WR_BADWAVEFILE;
+  return WR_OK;
+}
 WaveFunctions::WAVERESULT WaveFunctions::Read(WAVEFILEINFO& wave, void* data, size_t len, size_t* pBytesWritten)
 {
   if(!data || !len || !pBytesWritten)
     return WR_INVALIDPARAM;
 
-  unsigned long cur_offset = wave.callbacks.tell_func(wave.source);
+  if(wave.decode == WD_IMAADPCM)
+  {
+    *pBytesWritten = _readadpcm(wave, (char*)data, len);
+    return WR_OK;
+  }
+
+  uint64_t cur_offset = wave.callbacks.tell_func(wave.source);
 
+  bool g711 = (wave.decode == WD_MULAW || wave.decode == WD_ALAW);
   if(wave.wfEXT.Format.wBitsPerSample == 24)
     len = (len >> 2) * 3; // change len to the number of bytes we will actually read.
+  if(g711)
+    len >>= 1; // Every 8-bit sample turns into a 16-bit one
 
   if((cur_offset - wave.offset + len) > wave.size)
-    len = wave.size - (cur_offset - wave.offset);
+    len = (size_t)(wave.size - (cur_offset - wave.offset));
   *pBytesWritten = wave.callbacks.read_func(data, 1, len, wave.source);
 
   if(wave.wfEXT.Format.wBitsPerSample ==
      24) // We tell the user 24 bit streams are 32-bit and convert them behind the scenes. Ninja conversions.
   {
-    float* dest = (float*)data;
-    char* src   = (char*)data;
-    len /= 3;                     // Now len is the number of individual channel samples
-    for(size_t i = len; i-- > 0;) // We go backwards so we don't trip over ourselves
-    { // This whole thing can be SSE optimized to operate on 4 at a time but it'd be a total bitch to do
-      int a = *(int*)(src + (i * 3));
-      a     = (a & 0x00FFFFFF) |
-          (0xFF000000 * ((a & 0x800000) !=
-                         0)); // Cut out top 8 bits and the set them all equal to 1 if it was negative or 0 if it wasn't
-      dest[i] =
-        (float)a /
-        8388607.0f; // max signed integer value. This is exactly FLT_EPS, so this should preserve all 24-bits of precision.
-                    // Whether or not the FPU is set to a high enough precision for this to actually happen is up in the air.
-    }
-    *pBytesWritten = (len << 2); // We actually wrote 4*number of samples, not what we put in here earlier, so fix it
-  }
-
-  if(wave.wfEXT.Format.wBitsPerSample == 32 &&
-     wave.wfEXT.Format.wFormatTag != 3) // We can't read 32-bit integers, only floats, so convert.
-  {                                     // If we're reading 32-bit ints, convert them to floats.
-    size_t i    = 4;
-    size_t sz   = (*pBytesWritten) / 4;
-    int* src    = (int*)data; // Look at all this pointer aliasing!
-    float* dest = (float*)data;
-    for(; i < sz; i += 4) // SSE optimized conversions. We're losing about 8 bits of precision here, but we don't care
-                          // because no one can hear past 20 bits anyway.
-      BUN_SSE_STORE_UPS(dest + (i - 4), sseVec(sseVeci(BUN_UNALIGNED<const int>(src + (i - 4)))) / sseVec(2147483648.0f));
-    for(i -= 4; i < sz; ++i)
-    { // Traditional conversion for the last few
-      dest[i] = (float)src[i] / 2147483648.0f;
-    }
+    size_t num = (*pBytesWritten) / 3; // Number of individual channel samples we actually got
+    if(wave.decode == WD_INT32)
+      Kernels::Get().S24ToS32((int32_t*)data, (const uint8_t*)data, num);
+    else
+      Kernels::Get().S24ToFloat((float*)data, (const uint8_t*)data, num);
+    *pBytesWritten = (num << 2); // We actually wrote 4*number of samples, not what we put in here earlier, so fix it
+  }
+
+  if(g711)
+  {
+    if(wave.decode == WD_MULAW)
+      Kernels::Get().MulawToS16((int16_t*)data, (const uint8_t*)data, *pBytesWritten);
+    else
+      Kernels::Get().AlawToS16((int16_t*)data, (const uint8_t*)data, *pBytesWritten);
+    *pBytesWritten <<= 1;
   }
+
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  uint16_t tag = (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? (uint16_t)wave.wfEXT.Data1 : format.wFormatTag;
+  if(format.wBitsPerSample == 32 && tag != WAVE_FORMAT_IEEE_FLOAT &&
+     wave.decode != WD_INT32) // Unless we were asked for 32-bit integers, convert them to floats.
+    Kernels::Get().S32ToFloat((float*)data, (const int32_t*)data, (*pBytesWritten) / 4);
   return WR_OK;
 }
+const char* WaveFunctions::Peek(WAVEFILEINFO& wave, size_t len)
+{
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  uint16_t tag = (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? (uint16_t)wave.wfEXT.Data1 : format.wFormatTag;
+  if(wave.source != &wave.stream || wave.decode == WD_IMAADPCM || wave.decode == WD_MULAW || wave.decode == WD_ALAW ||
+     format.wBitsPerSample == 24 ||
+     (format.wBitsPerSample == 32 && tag != WAVE_FORMAT_IEEE_FLOAT && wave.decode != WD_INT32))
+    return nullptr; // Mirrors every conversion Read() can do
+
+  size_t pos = wave.stream.streampos - wave.stream.data;
+  if(pos < wave.offset || (pos - wave.offset + len) > wave.size)
+    return nullptr;
+  const char* r = wave.stream.streampos;
+  wave.stream.streampos += len;
+  return r;
+}
 WaveFunctions::WAVERESULT WaveFunctions::Seek(WAVEFILEINFO& wave, int64_t offset)
 {
   if(!wave.source)
     return WR_INVALIDPARAM;
   wave.callbacks.seek_func(wave.source, wave.offset + offset, SEEK_SET);
+  wave.blockpos = wave.blocklen = 0; // Whatever we decoded is stale now
   return WR_OK;
 }
 WaveFunctions::WAVERESULT WaveFunctions::Close(WAVEFILEINFO& wave)
 {
   wave.callbacks.close_func(wave.source);
+  free(wave.block);
+  wave.block = 0;
   return WR_OK;
 }
 uint64_t WaveFunctions::Tell(WAVEFILEINFO& wave) { return wave.callbacks.tell_func(wave.source) - wave.offset; }
 
-uint32_t WaveFunctions::WriteHeader(char* buffer, uint32_t length, uint16_t channels, uint16_t bits,
-                                        uint32_t freq)
+WaveFunctions::WAVERESULT WaveFunctions::SeekSample(WAVEFILEINFO& wave, uint64_t sample)
+{
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  if(format.wFormatTag != WAVE_FORMAT_IMA_ADPCM)
+    return Seek(wave, sample * (format.wBitsPerSample >> 3) * format.nChannels);
+
+  uint32_t frames = _adpcmframes(format.nChannels, format.nBlockAlign);
+  if(!frames)
+    return WR_BADWAVEFILE;
+  WAVERESULT r = Seek(wave, (sample / frames) * format.nBlockAlign);
+  if(r != WR_OK || wave.decode != WD_IMAADPCM || !(sample % frames))
+    return r; // If the engine decodes the blocks itself, the best we can do is the start of the block
+
+  // Decode the block and throw away everything before the sample we want
+  wave.blocklen = _adpcmblock(wave, 0);
+  wave.blockpos = std::min<uint32_t>(sample % frames, wave.blocklen);
+  return WR_OK;
+}
+uint64_t WaveFunctions::TellSample(WAVEFILEINFO& wave)
+{
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  if(format.wFormatTag != WAVE_FORMAT_IMA_ADPCM)
+  {
+    uint64_t frame = (format.wBitsPerSample >> 3) * format.nChannels;
+    return !frame ? 0 : Tell(wave) / frame;
+  }
+
+  uint32_t frames = _adpcmframes(format.nChannels, format.nBlockAlign);
+  if(!frames)
+    return 0;
+  uint64_t blocks = (Tell(wave) + format.nBlockAlign - 1) / format.nBlockAlign; // The last block can be short
+  if(wave.blocklen > 0) // The last block we read is still being handed out
+    return (blocks - 1) * frames + wave.blockpos;
+  return std::min<uint64_t>(blocks * frames, GetSamples(wave));
+}
+uint64_t WaveFunctions::GetSamples(const WAVEFILEINFO& wave)
+{
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  if(format.wFormatTag == WAVE_FORMAT_IMA_ADPCM)
+    return (wave.frames > 0) ? std::min(wave.frames, _adpcmtotal(wave)) : _adpcmtotal(wave);
+  uint64_t frame = format.wBitsPerSample * format.nChannels;
+  return !frame ? 0 : (wave.size << 3) / frame;
+}
+bool WaveFunctions::HasPadding(const WAVEFILEINFO& wave)
+{
+  return wave.wfEXT.Format.wFormatTag == WAVE_FORMAT_IMA_ADPCM && wave.frames > 0 && wave.frames < _adpcmtotal(wave);
+}
+// Every frame the blocks hold, including any padding at the end of the last one
+uint64_t WaveFunctions::_adpcmtotal(const WAVEFILEINFO& wave)
+{
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  return !format.nBlockAlign ? 0 :
+                               (wave.size / format.nBlockAlign) * _adpcmframes(format.nChannels, format.nBlockAlign) +
+                                 _adpcmframes(format.nChannels, wave.size % format.nBlockAlign);
+}
+
+std::pair<void*, uint64_t> WaveFunctions::ToImaAdpcm(const void* data, uint64_t datalength)
+{
+  static const std::pair<void*, uint64_t> NULLRET(nullptr, 0);
+  wav_callbacks callbacks = { dat_read_func, dat_seek_func, dat_close_func, dat_tell_func };
+  WAVEFILEINFO wave;
+  wave.stream.data = wave.stream.streampos = (const char*)data;
+  wave.stream.datalength                   = datalength;
+  if(Open(&wave.stream, &wave, callbacks) != WR_OK)
+    return NULLRET;
+
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  uint16_t tag     = (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? (uint16_t)wave.wfEXT.Data1 : format.wFormatTag;
+  bool isfloat     = (tag == WAVE_FORMAT_IEEE_FLOAT && format.wBitsPerSample == 32);
+  uint32_t channels = format.nChannels;
+  if(!channels || (!isfloat && (tag != WAVE_FORMAT_PCM || format.wBitsPerSample != 16)))
+  {
+    TINYOAL_LOG(2, "Only 16-bit and float PCM can be transcoded to IMA ADPCM, keeping the uncompressed wave");
+    return NULLRET;
+  }
+
+  // Same block size the Windows ACM encoder picks: 256 bytes per channel, scaled up with the sample rate
+  uint32_t align  = 256 * channels * std::max<uint32_t>(1, format.nSamplesPerSec / 11025);
+  align           = std::min<uint32_t>(align, (0xFFFF / (channels * 4)) * channels * 4); // nBlockAlign is 16-bit
+  uint32_t frames = _adpcmframes(channels, align);
+  size_t insize   = (isfloat ? sizeof(float) : sizeof(int16_t)) * channels;
+  uint64_t total  = wave.size / insize;
+  uint64_t blocks = (total + frames - 1) / frames;
+  uint32_t header = sizeof(WAVEFILEHEADER) + sizeof(RIFFCHUNK) + sizeof(IMAADPCMFORMAT) + sizeof(RIFFCHUNK) +
+                    sizeof(uint32_t) + sizeof(RIFFCHUNK);
+  if(!total || header + blocks * align > SIZE_MAX)
+    return NULLRET;
+
+  char* buffer = (char*)malloc((size_t)(header + blocks * align));
+  int16_t* pcm = (int16_t*)malloc(frames * channels * sizeof(int16_t) + channels);
+  if(!buffer || !pcm)
+  {
+    free(buffer);
+    free(pcm);
+    return NULLRET;
+  }
+  uint8_t* indices = (uint8_t*)(pcm + frames * channels);
+  memset(indices, 0, channels);
+
+  const char* src = (const char*)data + wave.offset;
+  uint8_t* out    = (uint8_t*)buffer + header;
+  for(uint64_t i = 0; i < total; i += frames)
+  {
+    size_t n      = (size_t)std::min<uint64_t>(frames, total - i);
+    size_t groups = (n + 6) / 8; // The block holds 1 + groups * 8 frames, so a short last block gets padded out
+    if(isfloat)
+    {
+      for(size_t j = 0; j < n * channels; ++j)
+      {
+        float f;
+        memcpy(&f, src + j * sizeof(float), sizeof(float));
+        f      = f * 32768.0f;
+        pcm[j] = (int16_t)((f < -32768.0f) ? -32768.0f : (f > 32767.0f) ? 32767.0f : f);
+      }
+    }
+    else
+      memcpy(pcm, src, n * insize);
+    for(size_t j = n; j < 1 + groups * 8; ++j) // Repeat the last frame, the fact chunk tells Read() to skip these
+      memcpy(pcm + j * channels, pcm + (n - 1) * channels, channels * sizeof(int16_t));
+
+    Kernels::Get().ImaAdpcmEncodeBlock(out, pcm, groups, channels, indices);
+    out += (1 + groups) * channels * 4;
+    src += n * insize;
+  }
+  free(pcm);
+
+  uint64_t size        = out - ((uint8_t*)buffer + header);
+  WAVEFILEHEADER& riff = *(WAVEFILEHEADER*)buffer;
+  memcpy(riff.RIFF, "RIFF", 4);
+  riff.sz = (uint32_t)std::min<uint64_t>(header + size - 8, 0xFFFFFFFF); // Open() reads 0xFFFFFFFF as "the rest"
+  memcpy(riff.WAVE, "WAVE", 4);
+
+  RIFFCHUNK& fmt = *(RIFFCHUNK*)(buffer + sizeof(WAVEFILEHEADER));
+  memcpy(fmt.name, "fmt ", 4);
+  fmt.size = sizeof(IMAADPCMFORMAT);
+
+  IMAADPCMFORMAT& ima  = *(IMAADPCMFORMAT*)(buffer + sizeof(WAVEFILEHEADER) + sizeof(RIFFCHUNK));
+  ima.wFormatTag       = WAVE_FORMAT_IMA_ADPCM;
+  ima.nChannels        = channels;
+  ima.nSamplesPerSec   = format.nSamplesPerSec;
+  ima.nAvgBytesPerSec  = (uint32_t)(((uint64_t)format.nSamplesPerSec * align) / frames);
+  ima.nBlockAlign      = align;
+  ima.wBitsPerSample   = 4;
+  ima.cbSize           = sizeof(uint16_t);
+  ima.wSamplesPerBlock = frames;
+
+  // The fact chunk holds the real length, so the padding at the end of the last block never gets played
+  RIFFCHUNK& fact = *(RIFFCHUNK*)(buffer + sizeof(WAVEFILEHEADER) + sizeof(RIFFCHUNK) + sizeof(IMAADPCMFORMAT));
+  memcpy(fact.name, "fact", 4);
+  fact.size       = sizeof(uint32_t);
+  uint32_t length = (uint32_t)std::min<uint64_t>(total, 0xFFFFFFFE); // 0xFFFFFFFF would mean "look in ds64"
+  memcpy((char*)&fact + sizeof(RIFFCHUNK), &length, sizeof(uint32_t));
+
+  RIFFCHUNK& chunk = *(RIFFCHUNK*)(buffer + header - sizeof(RIFFCHUNK));
+  memcpy(chunk.name, "data", 4);
+  chunk.size = (uint32_t)std::min<uint64_t>(size, 0xFFFFFFFF);
+  return std::pair<void*, uint64_t>(buffer, header + size);
+}
+
+std::pair<void*, uint64_t> WaveFunctions::ToMono(const void* data, uint64_t datalength)
+{
+  static const std::pair<void*, uint64_t> NULLRET(nullptr, 0);
+  wav_callbacks callbacks = { dat_read_func, dat_seek_func, dat_close_func, dat_tell_func };
+  WAVEFILEINFO wave;
+  wave.stream.data = wave.stream.streampos = (const char*)data;
+  wave.stream.datalength                   = datalength;
+  if(Open(&wave.stream, &wave, callbacks) != WR_OK)
+    return NULLRET;
+
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  uint16_t tag      = (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? (uint16_t)wave.wfEXT.Data1 : format.wFormatTag;
+  bool isfloat      = (tag == WAVE_FORMAT_IEEE_FLOAT && format.wBitsPerSample == 32);
+  uint32_t channels = format.nChannels;
+  if(channels == 1)
+    return NULLRET;
+  if(!channels || (!isfloat && (tag != WAVE_FORMAT_PCM || format.wBitsPerSample != 16)))
+  {
+    TINYOAL_LOG(2, "Only 16-bit and float PCM can be downmixed, keeping all the channels");
+    return NULLRET;
+  }
+
+  size_t insize   = isfloat ? sizeof(float) : sizeof(int16_t);
+  uint64_t total  = wave.size / (insize * channels);
+  uint32_t header = WriteHeader(0, 0, 0, 0, 0);
+  uint64_t length = header + total * insize; // Always smaller than the original
+  char* buffer    = (char*)malloc((size_t)length);
+  if(!total || !buffer)
+  {
+    free(buffer);
+    return NULLRET;
+  }
+
+  const char* src = (const char*)data + wave.offset;
+  if(isfloat)
+    Kernels::Get().DownmixFloat((float*)(buffer + header), (const float*)src, (size_t)total, channels);
+  else
+    Kernels::Get().DownmixS16((int16_t*)(buffer + header), (const int16_t*)src, (size_t)total, channels);
+
+  WriteHeader(buffer, length, 1, isfloat ? 32 : 16, format.nSamplesPerSec);
+  return std::pair<void*, uint64_t>(buffer, length);
+}
+
+std::pair<void*, uint64_t> WaveFunctions::Resample(const void* data, uint64_t datalength, uint32_t freq, uint64_t& loop)
+{
+  static const std::pair<void*, uint64_t> NULLRET(nullptr, 0);
+  wav_callbacks callbacks = { dat_read_func, dat_seek_func, dat_close_func, dat_tell_func };
+  WAVEFILEINFO wave;
+  wave.stream.data = wave.stream.streampos = (const char*)data;
+  wave.stream.datalength                   = datalength;
+  if(Open(&wave.stream, &wave, callbacks) != WR_OK)
+    return NULLRET;
+
+  const WAVEFORMATEX& format = wave.wfEXT.Format;
+  uint16_t tag      = (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) ? (uint16_t)wave.wfEXT.Data1 : format.wFormatTag;
+  bool isfloat      = (tag == WAVE_FORMAT_IEEE_FLOAT && format.wBitsPerSample == 32);
+  uint32_t channels = format.nChannels;
+  if(!freq || format.nSamplesPerSec == freq)
+    return NULLRET;
+  if(!channels || !format.nSamplesPerSec || (!isfloat && (tag != WAVE_FORMAT_PCM || format.wBitsPerSample != 16)))
+  {
+    TINYOAL_LOG(2, "Only 16-bit and float PCM can be resampled, keeping the original sample rate");
+    return NULLRET;
+  }
+
+  PolyphaseFilter filter(format.nSamplesPerSec, freq);
+  size_t insize     = isfloat ? sizeof(float) : sizeof(int16_t);
+  uint64_t total    = wave.size / (insize * channels);
+  uint64_t outtotal = (total * filter.out + filter.in - 1) / filter.in;
+  uint32_t header   = WriteHeader(0, 0, 0, 0, 0);
+  uint64_t length   = header + outtotal * insize * channels;
+  if(!total || length > SIZE_MAX)
+    return NULLRET;
+
+  // One channel at a time goes through a zero padded planar buffer, because that's what the filter kernels work on
+  size_t front     = filter.taps / 2 - 1;
+  char* buffer     = (char*)malloc((size_t)length);
+  float* planar    = (float*)calloc(total + filter.taps, sizeof(float));
+  float* resampled = (float*)malloc(outtotal * sizeof(float));
+  if(!buffer || !planar || !resampled)
+  {
+    free(buffer);
+    free(planar);
+    free(resampled);
+    return NULLRET;
+  }
+
+  const char* src = (const char*)data + wave.offset;
+  char* dst       = buffer + header;
+  for(uint32_t c = 0; c < channels; ++c)
+  {
+    for(uint64_t i = 0; i < total; ++i)
+    {
+      const char* p = src + (i * channels + c) * insize;
+      if(isfloat)
+        memcpy(planar + front + i, p, sizeof(float));
+      else
+      {
+        int16_t v;
+        memcpy(&v, p, sizeof(int16_t));
+        planar[front + i] = v * (1.0f / 32768.0f);
+      }
+    }
+
+    Kernels::Get().Resample(resampled, planar, (size_t)outtotal, filter, 0);
+
+    for(uint64_t i = 0; i < outtotal; ++i)
+    {
+      char* p = dst + (i * channels + c) * insize;
+      if(isfloat)
+        memcpy(p, resampled + i, sizeof(float));
+      else
+      {
+        float f   = resampled[i] * 32768.0f;
+        int16_t v = (int16_t)lrintf((f < -32768.0f) ? -32768.0f : (f > 32767.0f) ? 32767.0f : f);
+        memcpy(p, &v, sizeof(int16_t));
+      }
+    }
+  }
+  free(planar);
+  free(resampled);
+
+  if(loop != (uint64_t)-1)
+    loop = (loop * filter.out) / filter.in;
+  WriteHeader(buffer, length, channels, isfloat ? 32 : 16, freq);
+  return std::pair<void*, uint64_t>(buffer, length);
+}
+
+size_t WaveFunctions::_readadpcm(WAVEFILEINFO& wave, char* data, size_t len)
+{
+  uint32_t channels = wave.wfEXT.Format.nChannels;
+  uint32_t frames   = _adpcmframes(channels, wave.wfEXT.Format.nBlockAlign);
+  size_t frame      = channels * sizeof(int16_t);
+  size_t written    = 0;
+
+  if(wave.frames > 0) // Stop where the fact chunk says the sound ends, instead of handing out the padding after it
+  {
+    uint64_t pos = TellSample(wave);
+    len          = (size_t)std::min<uint64_t>(len, (pos < wave.frames) ? (wave.frames - pos) * frame : 0);
+  }
+
+  while(frames > 0 && len - written >= frame)
+  {
+    if(wave.blockpos < wave.blocklen) // Hand out what's left of the last block first
+    {
+      size_t n = std::min<size_t>((len - written) / frame, wave.blocklen - wave.blockpos);
+      memcpy(data + written, wave.block + wave.wfEXT.Format.nBlockAlign + wave.blockpos * frame, n * frame);
+      wave.blockpos += (uint32_t)n;
+      written += n * frame;
+    }
+    else if(len - written >= frames * frame) // A whole block fits, so decode it straight into the output
+    {
+      wave.blockpos = wave.blocklen = 0;
+      uint32_t n = _adpcmblock(wave, (int16_t*)(data + written));
+      if(!n)
+        break;
+      written += n * frame;
+    }
+    else if(!(wave.blocklen = _adpcmblock(wave, 0)))
+      break;
+    else
+      wave.blockpos = 0;
+  }
+
+  return written;
+}
+
+// Reads the next block and decodes it into dst, or into the block buffer if dst is NULL. Returns the number of frames.
+uint32_t WaveFunctions::_adpcmblock(WAVEFILEINFO& wave, int16_t* dst)
+{
+  uint32_t channels = wave.wfEXT.Format.nChannels;
+  uint32_t align    = wave.wfEXT.Format.nBlockAlign;
+  if(!wave.block)
+  {
+    wave.block = (uint8_t*)malloc(align + _adpcmframes(channels, align) * channels * sizeof(int16_t));
+    if(!wave.block)
+      return 0;
+  }
+
+  uint64_t pos = Tell(wave);
+  if(pos >= wave.size)
+    return 0;
+  size_t len = wave.callbacks.read_func(wave.block, 1, (size_t)std::min<uint64_t>(align, wave.size - pos), wave.source);
+  uint32_t n = _adpcmframes(channels, len);
+  if(n > 0)
+    Kernels::Get().ImaAdpcmBlock(!dst ? (int16_t*)(wave.block + align) : dst, wave.block, (n - 1) / 8, channels);
+  return n;
+}
+
+// Each block starts with a 4 byte header per channel, which holds the first sample, and every 4 bytes per channel after
+// that hold another 8 samples.
+uint32_t WaveFunctions::_adpcmframes(uint32_t channels, size_t bytes)
+{
+  if(!channels || bytes < channels * 4)
+    return 0;
+  return 1 + (uint32_t)((bytes - channels * 4) / (channels * 4)) * 8;
+}
+
+uint32_t WaveFunctions::WriteHeader(char* buffer, uint64_t length, uint16_t channels, uint16_t bits, uint32_t freq)
 {
   static const int FULL_HEADER_SIZE =
     sizeof(WAVEFILEHEADER) + sizeof(RIFFCHUNK) + sizeof(WAVEFORMATEX) - sizeof(uint16_t) + sizeof(RIFFCHUNK);
@@ -162,7 +625,7 @@ uint32_t WaveFunctions::WriteHeader(char* buffer, uint32_t length, uint16_t chan
 
   WAVEFILEHEADER& header = *(WAVEFILEHEADER*)buffer;
   memcpy(header.RIFF, "RIFF", 4);
-  header.sz = length - 8; // don't include RIFF or sz itself in this count
+  header.sz = (uint32_t)std::min<uint64_t>(length - 8, 0xFFFFFFFF); // don't include RIFF or sz itself in this count
   memcpy(header.WAVE, "WAVE", 4);
 
   buffer += sizeof(WAVEFILEHEADER);
@@ -182,6 +645,6 @@ uint32_t WaveFunctions::WriteHeader(char* buffer, uint32_t length, uint16_t chan
   buffer += fmt.size;
   RIFFCHUNK& data = *(RIFFCHUNK*)buffer;
   memcpy(data.name, "data", 4);
-  data.size = length - FULL_HEADER_SIZE;
+  data.size = (uint32_t)std::min<uint64_t>(length - FULL_HEADER_SIZE, 0xFFFFFFFF);
   return data.size;
 }
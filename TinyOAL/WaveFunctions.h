@@ -75,16 +75,22 @@ namespace tinyoal {
     size_t (*read_func)(void* ptr, size_t size, size_t nmemb, void* datasource);
     int (*seek_func)(void* datasource, int64_t offset, int whence);
     int (*close_func)(void* datasource);
-    long (*tell_func)(void* datasource);
+    int64_t (*tell_func)(void* datasource);
   };
 
   typedef struct WaveFileInfo
   {
     WAVEFORMATEXTENSIBLE wfEXT; // This contains WAVEFORMATEX as well
-    size_t offset;
-    size_t size;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t frames; // Frame count from the fact chunk, which is shorter than the data if the last ADPCM block is padded
     wav_callbacks callbacks;
     void* source;
+    uint8_t decode;    // One of WaveFunctions::WAVEDECODE
+    uint8_t* block;    // One compressed block followed by the frames decoded from it, allocated on the first Read()
+    uint32_t blockpos; // Frames of the decoded block that were already handed out
+    uint32_t blocklen; // Frames in the decoded block
+    FileStream file;   // This stream's own cursor, if the wave is read from a file
     DatStream stream;
   } WAVEFILEINFO;
 
@@ -98,15 +104,49 @@ namespace tinyoal {
       WR_INVALIDPARAM = -2,
     };
 
+    // How Read() should hand out samples that can't be played as-is
+    enum WAVEDECODE : uint8_t
+    {
+      WD_DEFAULT = 0, // 24-bit and 32-bit integer samples are converted to floats
+      WD_INT32   = 1, // 24-bit samples are widened to 32-bit integers, and 32-bit integers are left alone
+      WD_IMAADPCM = 2, // IMA ADPCM blocks are decoded to 16-bit samples, for engines that can't play them directly
+      WD_MULAW    = 3, // G.711 mu-law and A-law samples are expanded to 16-bit samples, for the same reason
+      WD_ALAW     = 4,
+    };
+
     WaveFunctions();
     WAVERESULT Open(void* source, WAVEFILEINFO* wave, wav_callbacks& callbacks);
     WAVERESULT Read(WAVEFILEINFO& wave, void* data, size_t len, size_t* pBytesWritten);
+    // If the wave is in memory and Read() would copy its samples out unchanged, returns a pointer to the next len bytes
+    // and moves past them. Returns NULL without moving if there aren't len bytes left or the samples need converting.
+    const char* Peek(WAVEFILEINFO& wave, size_t len);
     WAVERESULT Seek(WAVEFILEINFO& wave, int64_t offset);
     uint64_t Tell(WAVEFILEINFO& wave);
+    // Sample based versions of Seek and Tell, which also know how to find their way around ADPCM blocks
+    WAVERESULT SeekSample(WAVEFILEINFO& wave, uint64_t sample);
+    uint64_t TellSample(WAVEFILEINFO& wave);
+    uint64_t GetSamples(const WAVEFILEINFO& wave);
+    // True if the fact chunk says the last ADPCM block has frames on the end that aren't part of the sound
+    bool HasPadding(const WAVEFILEINFO& wave);
     WAVERESULT Close(WAVEFILEINFO& wave);
     uint32_t GetALFormat(WAVEFILEINFO& wave); // cast this to ALenum
-    uint32_t WriteHeader(char* buffer, uint32_t length, uint16_t channels, uint16_t bits,
-                             uint32_t freq);
+    // Writes a plain RIFF header, so a length that doesn't fit in 32 bits stores 0xFFFFFFFF as the size, which Open()
+    // takes to mean the data runs to the end of the stream.
+    uint32_t WriteHeader(char* buffer, uint64_t length, uint16_t channels, uint16_t bits, uint32_t freq);
+    // Transcodes an in-memory 16-bit or float PCM wave file to a new IMA ADPCM wave file. Returns NULL on failure.
+    std::pair<void*, uint64_t> ToImaAdpcm(const void* data, uint64_t datalength);
+    // Downmixes an in-memory 16-bit or float PCM wave file to mono. Returns NULL on failure, or if it's already mono.
+    std::pair<void*, uint64_t> ToMono(const void* data, uint64_t datalength);
+    // Resamples an in-memory 16-bit or float PCM wave file to freq, moving loop to the new rate if it's set. Returns NULL
+    // on failure, or if the wave is already at that rate.
+    std::pair<void*, uint64_t> Resample(const void* data, uint64_t datalength, uint32_t freq, uint64_t& loop);
+
+  protected:
+    WAVERESULT _openw64(WAVEFILEINFO& wave);
+    size_t _readadpcm(WAVEFILEINFO& wave, char* data, size_t len);
+    uint32_t _adpcmblock(WAVEFILEINFO& wave, int16_t* dst);
+    static uint32_t _adpcmframes(uint32_t channels, size_t bytes);
+    static uint64_t _adpcmtotal(const WAVEFILEINFO& wave);
   };
 }
 
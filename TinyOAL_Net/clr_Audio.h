@@ -12,7 +12,7 @@ namespace tinyoal { class Audio; }
 
 namespace TinyOAL_net {
   ref class clr_AudioResource;
-  typedef unsigned char CLR_TINYOAL_FLAG;
+  typedef unsigned short CLR_TINYOAL_FLAG;
 
 	/* Managed wrapper for Audio class. Due to the nature of the audio engine, no other Managed wrappers are actually necessary. */
   public ref class clr_Audio
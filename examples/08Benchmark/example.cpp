@@ -0,0 +1,97 @@
+/* Example 08 - Benchmark
+ * -------------------------
+ * This example measures how fast each codec decodes without playing anything. Build it once normally and once with
+ * TINYOAL_STATIC_CODECS to compare codecs loaded at runtime against codecs linked into TinyOAL.
+ *
+ * Copyright (c)2020 Erik McClure
+ */
+
+#include "tinyoal/TinyOAL.h"
+#include <iostream>
+#include <chrono>
+
+using namespace tinyoal;
+using namespace bun;
+
+typedef std::chrono::steady_clock CLOCK;
+
+inline double elapsed(CLOCK::time_point start)
+{
+  return std::chrono::duration<double>(CLOCK::now() - start).count();
+}
+
+// Opens and closes a stream over and over, which is mostly spent parsing headers and setting up the decoder
+double benchopen(AudioResource* res, int count)
+{
+  CLOCK::time_point start = CLOCK::now();
+  for(int i = 0; i < count; ++i)
+  {
+    void* stream = res->OpenStream();
+    if(!stream)
+      return -1.0;
+    res->CloseStream(stream);
+  }
+  return elapsed(start) / count;
+}
+
+// Decodes the entire resource count times, returning the seconds it took and the number of bytes it decoded per pass
+double benchdecode(AudioResource* res, int count, size_t& decoded)
+{
+  char* buf = new char[res->GetBufSize()];
+  CLOCK::time_point start = CLOCK::now();
+  for(int i = 0; i < count; ++i)
+  {
+    void* stream = res->OpenStream();
+    if(!stream)
+      break;
+    bool eof = false;
+    decoded  = 0;
+    while(!eof)
+    {
+      unsigned long n = res->Read(stream, buf, res->GetBufSize(), eof);
+      if(!n)
+        break;
+      decoded += n;
+    }
+    res->CloseStream(stream);
+  }
+  delete[] buf;
+  return elapsed(start) / count;
+}
+
+int main(int argc, char** argv)
+{
+  int passes = (argc > 1) ? atoi(argv[1]) : 5;
+  if(passes < 1)
+    passes = 1;
+
+  TinyOAL::SetSettingsStream(0);
+  CLOCK::time_point start = CLOCK::now();
+  TinyOAL engine(ENGINE_OPENAL, nullptr, 4); // This is where codec libraries get loaded when they aren't linked in
+  std::cout << "Engine startup: " << (elapsed(start) * 1000.0) << " ms" << std::endl;
+
+  const char* files[] = { "../media/idea549.wav", "../media/idea803.ogg", "../media/idea813.mp3",
+                          "../media/idea835.flac" };
+
+  for(const char* file : files)
+  {
+    // Copying the file into memory keeps disk access out of the numbers
+    AudioResource* res = AudioResource::Create(file, (TINYOAL_FLAG)TINYOAL_COPYINTOMEMORY);
+    if(!res)
+    {
+      std::cout << file << ": failed to load" << std::endl;
+      continue;
+    }
+
+    size_t decoded = 0;
+    double open    = benchopen(res, passes * 10);
+    double decode  = benchdecode(res, passes, decoded);
+    double length  = res->GetLength();
+
+    std::cout << file << ": open " << (open * 1000.0) << " ms, decode " << (decode * 1000.0) << " ms ("
+              << (decoded / decode / (1024.0 * 1024.0)) << " MiB/s, " << (length / decode) << "x realtime)" << std::endl;
+    res->Drop();
+  }
+
+  return 0;
+}
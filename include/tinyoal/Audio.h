@@ -11,7 +11,7 @@
 #include "buntils/buntils.h"
 
 namespace tinyoal {
-  typedef uint8_t TINYOAL_FLAG;
+  typedef uint16_t TINYOAL_FLAG;
 
   enum TINYOAL_FLAGS : TINYOAL_FLAG
   {
@@ -22,10 +22,23 @@ namespace tinyoal {
     TINYOAL_ISFILE      = 8,
     TINYOAL_FORCETOWAVE = 16 + 1, // Forces the resource to be copied into memory as an uncompressed wave for efficient
                                   // playback. Implies TINYOAL_COPYINTOMEMORY
+    TINYOAL_INT32 = 32, // Decodes 24-bit and 32-bit integer WAV data to 32-bit integers instead of floats. Ignored by
+                        // OpenAL, which can't play them, while WASAPI always gets integers whether this is set or not.
+    TINYOAL_FORCETOADPCM = 64 + TINYOAL_FORCETOWAVE, // Like TINYOAL_FORCETOWAVE, but transcodes the wave to IMA ADPCM,
+                                                     // which takes a quarter of the memory and is decoded as it plays.
+    TINYOAL_RESAMPLE = 128 + TINYOAL_FORCETOWAVE, // Like TINYOAL_FORCETOWAVE, but also converts the wave to the sample rate
+                                                  // of the output device, so the mixer doesn't have to resample it.
+    TINYOAL_SPATIAL = 256 + TINYOAL_FORCETOWAVE, // Marks the resource as positional. OpenAL only positions mono sources, so
+                                                 // the wave is downmixed to mono, which also halves the cost of stereo files.
+    TINYOAL_MMAP = 512, // Maps the file into memory instead of reading it, so every process that loads the same file shares
+                        // one copy in the page cache. Only used by AudioResource::Create(const char*).
+    TINYOAL_MMAPRANDOM = 1024 + TINYOAL_MMAP, // Like TINYOAL_MMAP, but tells the kernel the resource seeks around so much
+                                              // that reading ahead of it would only waste memory.
   };
 
   class AudioResource;
   class Source;
+  struct AudioCache;
 
   // TODO: Rip the "managed" behavior into a subtype to isolate it from an unmanaged instance. There is no need for 
   // a TINYOAL_MANAGED flag because this should be determined at compile time.
@@ -83,11 +96,15 @@ namespace tinyoal {
     Audio& operator=(Audio&& mov);
 
     static unsigned long ReadBuffer(unsigned long bufsize, char* buffer, void* context);
+    static const char* PeekBuffer(unsigned long bufsize, void* context);
 
   protected:
     void _applyAll(); // In case we have to reset our openAL source, this reapplies all volume/pitch/location modifications
     void _stop();
     unsigned long _readBuffer(unsigned long bufsize, char* buffer);
+    unsigned long _read(char* buffer, unsigned long len, bool& eof);
+    void _park();
+    bool _unpark(uint64_t sample);
 
     AudioResource* _resource;
     Source* _source;
@@ -97,6 +114,10 @@ namespace tinyoal {
     float _pitch;
     bun::BitField<TINYOAL_FLAG> _flags;
     uint64_t _looptime;
+    const AudioCache* _cache; // Decoded samples on the resource we're copying from instead of reading the stream, if any
+    size_t _cachepos;
+    void* _parked;      // Second stream waiting where the next loop picks up the stream, so wrapping doesn't seek
+    uint64_t _parkedat; // Where _parked was last sent, or -1 if it hasn't been sent anywhere since it was swapped out
   };
 }
 
@@ -13,6 +13,15 @@
 #include <stdio.h>
 
 namespace tinyoal {
+  // A run of decoded samples kept on a resource, so instances can copy them instead of decoding
+  struct AudioCache
+  {
+    char* data;
+    size_t len;
+    uint64_t start; // Sample the cached data starts at
+    bool eof;       // The cache runs all the way to the end of the stream
+  };
+
   // Holds information about a given audio resource. An audio resource is different from an actual Audio instance, in that
   // it holds the raw audio information, which is then ACCESSED by any number of Audio instances. This prevents memory
   // wasting.
@@ -41,6 +50,7 @@ namespace tinyoal {
       TINYOAL_FILETYPE_OGG,
       TINYOAL_FILETYPE_MP3,
       TINYOAL_FILETYPE_FLAC,
+      TINYOAL_FILETYPE_OPUS,
       TINYOAL_FILETYPE_CUSTOM, // Add custom filetypes here
     };
 
@@ -66,10 +76,10 @@ namespace tinyoal {
     // parameter
     static AudioResource* Create(const char* file, TINYOAL_FLAG flags = 0,
                                  unsigned char filetype = TINYOAL_FILETYPE_UNKNOWN, uint64_t loop = (uint64_t)-1);
-    static AudioResource* Create(const void* data, unsigned int datalength, TINYOAL_FLAG flags = 0,
+    static AudioResource* Create(const void* data, uint64_t datalength, TINYOAL_FLAG flags = 0,
                                  unsigned char filetype = TINYOAL_FILETYPE_UNKNOWN, uint64_t loop = (uint64_t)-1);
     // On Windows, file-locks are binary-exclusive, so if you don't explicitely set the sharing properly, this won't work.
-    static AudioResource* Create(FILE* file, unsigned int datalength, TINYOAL_FLAG flags = 0,
+    static AudioResource* Create(FILE* file, uint64_t datalength, TINYOAL_FLAG flags = 0,
                                  unsigned char filetype = TINYOAL_FILETYPE_UNKNOWN, uint64_t loop = (uint64_t)-1);
 
   protected:
@@ -80,19 +90,22 @@ namespace tinyoal {
     AudioResource(AudioResource&&)      = delete;
     AudioResource& operator=(const AudioResource&) = delete;
     AudioResource& operator=(AudioResource&&) = delete;
-    AudioResource(void* data, unsigned int len, TINYOAL_FLAG flags, unsigned char filetype, uint64_t loop);
+    AudioResource(void* data, uint64_t len, TINYOAL_FLAG flags, unsigned char filetype, uint64_t loop);
     virtual ~AudioResource();
     void _destruct();
+    void _cache(AudioCache& cache, uint64_t start, unsigned int milliseconds);
 
-    static AudioResource* _fcreate(FILE* file, unsigned int datalength, TINYOAL_FLAG flags, unsigned char filetype,
+    static AudioResource* _fcreate(FILE* file, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                    const char* path, uint64_t loop);
-    static AudioResource* _create(void* data, unsigned int datalength, TINYOAL_FLAG flags, unsigned char filetype,
+    static AudioResource* _create(void* data, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                   const char* path, uint64_t loop);
-    static AudioResource* _force(void* data, unsigned int datalength, TINYOAL_FLAG flags, unsigned char filetype,
+    static AudioResource* _force(void* data, uint64_t datalength, TINYOAL_FLAG flags, unsigned char filetype,
                                  const char* path, uint64_t loop);
+    static void* _mapfile(const char* file, uint64_t& datalength, TINYOAL_FLAG flags);
+    static void _unmapfile(void* data, uint64_t datalength);
 
     void* _data;
-    size_t _datalength;
+    uint64_t _datalength;
     bun::BitField<TINYOAL_FLAG> _flags;
     const TINYOAL_FILETYPE _filetype;
     unsigned int _freq;
@@ -108,24 +121,61 @@ namespace tinyoal {
     Audio* _inactivelist;
     unsigned int _numactive;
     unsigned int _maxactive;
+    AudioCache _prefix;    // The first few decoded buffers, so new instances can start playing without decoding anything
+    AudioCache _loopcache; // Decoded samples from the loop point, so looping doesn't have to seek
+
+  public:
+    // Returns a pointer to the next len bytes of the stream and moves past them, if the resource already has them in
+    // memory exactly as the engine will play them. Returns NULL without moving if they have to be copied out with Read.
+    // This is declared after every other virtual function so it goes on the end of the vtable, where it doesn't move the
+    // slots codecs built against older versions call through.
+    virtual const char* Peek(void* /*stream*/, unsigned int /*len*/) { return nullptr; }
   };
 
   typedef struct DATSTREAM
   {
     const char* data;
-    size_t datalength;
+    uint64_t datalength; // Also holds the length of a file for codecs that overlay a FILE* on top of this
     const char* streampos;
   } DatStream;
 
+  struct ReadAheadBlock;
+
+  // A cursor into a file that belongs to a single stream. Reads go through pread (or an offset ReadFile on Windows), so
+  // any number of streams can read the same FILE* without moving each other around, and small reads come out of a
+  // read-ahead buffer so decoders that ask for a few bytes at a time don't turn every one into a system call. While the
+  // decoder works through the buffer, the block after it is read on the read-ahead thread.
+  typedef struct FILESTREAM
+  {
+    FILE* file;
+    uint64_t start; // Where the data starts in the file, every other position is relative to this
+    uint64_t datalength;
+    uint64_t pos;
+    char* buffer;    // Allocated on the first small read, and freed by filestream_close_func
+    uint64_t bufpos; // Position the buffer was read from
+    uint32_t buflen;
+    uint32_t bufcap;       // Grows to fit the largest read, so streams that read a lot at once can be read ahead too
+    ReadAheadBlock* ahead; // The block after the buffer, allocated on the first read
+    bool readahead;        // False for streams read off the main thread, which can't touch the read-ahead thread or pool
+  } FileStream;
+
   // 8 functions - Four for parsing pure void*, and four for reading files
   extern size_t dat_read_func(void* ptr, size_t size, size_t nmemb, void* datasource);
   extern int dat_seek_func(void* datasource, int64_t offset, int whence);
   extern int dat_close_func(void* datasource);
-  extern long dat_tell_func(void* datasource);
+  extern int64_t dat_tell_func(void* datasource);
   extern size_t file_read_func(void* ptr, size_t size, size_t nmemb, void* datasource);
-  extern int file_seek_func(void* datasource, int64_t offset, int whence);
+  extern int file_seek_func(void* datasource, int64_t offset, int whence); // 64-bit even where long is 32 bits
   extern int file_close_func(void* datasource);
-  extern long file_tell_func(void* datasource);
+  extern int64_t file_tell_func(void* datasource);
+  // The same four functions for a FileStream, along with the positioned read they're built on
+  extern void filestream_init(FileStream& stream, FILE* file, uint64_t start, uint64_t datalength,
+                              bool readahead = true);
+  extern size_t filestream_read_func(void* ptr, size_t size, size_t nmemb, void* datasource);
+  extern int filestream_seek_func(void* datasource, int64_t offset, int whence);
+  extern int filestream_close_func(void* datasource);
+  extern int64_t filestream_tell_func(void* datasource);
+  extern size_t file_pread(FILE* file, void* ptr, size_t len, uint64_t offset);
 }
 
 #endif
\ No newline at end of file
@@ -28,7 +28,10 @@ namespace tinyoal {
   class Mp3Functions;
   class WaveFunctions;
   class FlacFunctions;
+  class OpusFunctions;
   class Engine;
+  class ReadAhead;
+  class SeekIndexer;
 
   enum ENGINE_TYPE
   {
@@ -47,7 +50,7 @@ namespace tinyoal {
     // Constructors
     TinyOAL(enum ENGINE_TYPE type = ENGINE_OPENAL, FNLOG fnLog = nullptr, unsigned char bufferCount = 4,
             const char* forceOAL = nullptr, const char* forceOGG = nullptr, const char* forceFLAC = nullptr,
-            const char* forceMP3 = nullptr);
+            const char* forceMP3 = nullptr, const char* forceOPUS = nullptr);
     ~TinyOAL();
     // This updates any currently playing samples and returns the number that are still playing after the update. The time
     // between calls to this update function can never exceed the length of a buffer, or the sound will cut out.
@@ -61,11 +64,11 @@ namespace tinyoal {
     {
       return PlaySound(AudioResource::Create(file, flags), flags);
     }
-    inline Audio* PlaySound(const void* data, unsigned int len, TINYOAL_FLAG flags)
+    inline Audio* PlaySound(const void* data, uint64_t len, TINYOAL_FLAG flags)
     {
       return PlaySound(AudioResource::Create(data, len, flags), flags);
     }
-    inline Audio* PlaySound(FILE* file, unsigned int len, TINYOAL_FLAG flags)
+    inline Audio* PlaySound(FILE* file, uint64_t len, TINYOAL_FLAG flags)
     {
       return PlaySound(AudioResource::Create(file, len, flags), flags);
     }
@@ -75,6 +78,10 @@ namespace tinyoal {
     static TinyOAL* Instance();
     // Gets the underlying engine
     Engine* GetEngine();
+    // Gets the background thread file-backed streams read ahead on
+    inline ReadAhead* GetReadAhead() const { return _readahead.get(); }
+    // Gets the background thread OGG and FLAC resources build their seek indexes on
+    inline SeekIndexer* GetSeekIndexer() const { return _seekindexer.get(); }
     // Gets the name of the default device
     size_t GetDefaultDevice(char* out, size_t len);
     // Sets current device to the given device
@@ -83,6 +90,23 @@ namespace tinyoal {
     const char* GetDevices();
     // Sets the logging function, returns the previous one.
     FNLOG SetLogging(FNLOG fnLog);
+    // If enabled, OGG, MP3 and FLAC resources created afterwards decode straight to 32-bit float samples instead of 16-bit
+    // integers, which skips the conversion back to float in the mixer and can't clip. Only the OpenAL engine can play
+    // float samples, so this returns false and stays disabled on any other engine.
+    bool SetFloatDecode(bool enable);
+    inline bool GetFloatDecode() const { return _floatdecode; }
+    // Name of the mpg123 decoder MP3 resources are decoded with, or NULL if mpg123 isn't loaded or no MP3 has been opened
+    const char* GetMp3Decoder() const;
+    // Compressed resources created afterwards decode this many milliseconds up front and keep them, so new instances can
+    // fill their first buffers with a copy instead of decoding. To cover the whole initial fill this should be the buffer
+    // count times 250. Defaults to 0, which disables the cache.
+    inline void SetPrefixCache(unsigned int milliseconds) { _prefixms = milliseconds; }
+    inline unsigned int GetPrefixCache() const { return _prefixms; }
+    // Compressed resources with a loop point created afterwards also keep this many milliseconds decoded from the loop
+    // point, so looping back copies them while the stream waiting after them takes over. If the whole loop fits, looping
+    // never needs that stream at all. Defaults to 0, which disables the cache.
+    inline void SetLoopCache(unsigned int milliseconds) { _loopms = milliseconds; }
+    inline unsigned int GetLoopCache() const { return _loopms; }
     // Given a file or stream, creates or overwrites the openal config file in the proper magical location (%APPDATA% on
     // windows)
     static void SetSettings(const char* file);
@@ -91,11 +115,12 @@ namespace tinyoal {
     inline OggFunctions* GetOgg() const { return _oggFuncs.get(); }
     inline Mp3Functions* GetMp3() const { return _mp3Funcs.get(); }
     inline FlacFunctions* GetFlac() const { return _flacFuncs.get(); }
+    inline OpusFunctions* GetOpus() const { return _opusFuncs.get(); }
     inline WaveFunctions* GetWave() const { return _waveFuncs.get(); }
 
-    typedef size_t (*CODEC_CONSTRUCT)(void* p, void* data, unsigned int datalength, TINYOAL_FLAG flags, uint64_t loop);
+    typedef size_t (*CODEC_CONSTRUCT)(void* p, void* data, uint64_t datalength, TINYOAL_FLAG flags, uint64_t loop);
     typedef bool (*CODEC_SCANHEADER)(const char* fileheader);
-    typedef std::pair<void*, unsigned int> (*CODEC_TOWAVE)(void* data, unsigned int datalength, TINYOAL_FLAG flags);
+    typedef std::pair<void*, uint64_t> (*CODEC_TOWAVE)(void* data, uint64_t datalength, TINYOAL_FLAG flags);
 
     struct Codec
     {
@@ -122,19 +147,25 @@ namespace tinyoal {
     TinyOAL(TinyOAL&&)                 = delete;
     TinyOAL& operator=(const TinyOAL&) = delete;
     TinyOAL& operator=(TinyOAL&&)      = delete;
-    void _construct(const char* forceOGG, const char* forceFLAC, const char* forceMP3);
+    void _construct(const char* forceOGG, const char* forceFLAC, const char* forceMP3, const char* forceOPUS);
     void _addAudio(Audio* ref, AudioResource* res);
     void _removeAudio(Audio* ref, AudioResource* res);
     char* _allocDecoder(unsigned int sz);
     void _deallocDecoder(char* p, unsigned int sz);
-    unsigned char _getFiletype(const char* fileheader); // fileheader must be at least 4 characters long
+    // Codecs are handed the first 36 bytes, enough to see past the Ogg page header, padded with zeros if len is shorter
+    unsigned char _getFiletype(const char* fileheader, size_t len);
 
     static int DefaultLog(const char* FILE, unsigned int LINE, unsigned char level, const char* format, va_list args);
 
     static TinyOAL* _instance;
 
     FNLOG _fnLog;
+    bool _floatdecode;
+    unsigned int _prefixms;
+    unsigned int _loopms;
     std::unique_ptr<Engine> _engine;
+    std::unique_ptr<ReadAhead> _readahead;
+    std::unique_ptr<SeekIndexer> _seekindexer;
     AudioResource* _activereslist;
     AudioResource* _reslist;
     bun::Hash<unsigned int, std::unique_ptr<bun::BlockAlloc>, bun::ARRAY_MOVE> _treealloc;
@@ -145,6 +176,7 @@ namespace tinyoal {
     std::unique_ptr<Mp3Functions> _mp3Funcs;
     std::unique_ptr<WaveFunctions> _waveFuncs;
     std::unique_ptr<FlacFunctions> _flacFuncs;
+    std::unique_ptr<OpusFunctions> _opusFuncs;
   };
 
 }